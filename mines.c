@@ -1,10 +1,35 @@
 #include <ctype.h>
+#include <limits.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+/** What happened when a move was made. */
+enum outcome {
+	/** The move was not allowed, and nothing changed. */
+	REFUSED,
+	/** The game goes on. */
+	PLAYING,
+	/** The move flagged the last mine. */
+	WON,
+	/** The move revealed a mine. */
+	LOST
+};
+
+/** A revealed number as seen by the probability solver: the sum of the mines
+  * under its hidden, unflagged neighbours equals need. */
+struct constraint {
+	/* The number of mines among vars. */
+	int need;
+	/* The number of variables. */
+	int n_vars;
+	/* The frontier variables around the number. */
+	int vars[8];
+};
+
 /** A tile in g_board. */
 struct tile {
 	/* Whether the tile has a mine. */
@@ -19,6 +44,10 @@ struct tile {
 	unsigned angle : 4;
 	/* The number of mines around the tile. */
 	unsigned around : 4;
+	/* The numbers of flagged tiles, of tiles neither flagged nor revealed,
+	 * and of revealed tiles without mines around the tile. Kept up to
+	 * date by set_tile(). */
+	unsigned flags_around : 4, unknown_around : 4, numbers_around : 4;
 };
 
 /* CONSTANTS */
@@ -34,8 +63,116 @@ struct tile {
 #define MIN_MINES 0
 /** Maximum number of mines on the board. */
 #define MAX_MINES 780
+/** Maximum number of tiles on the board. */
+#define MAX_TILES (MAX_WIDTH * MAX_HEIGHT)
+/** Components with more variables than this are swept rather than enumerated
+  * if their sweep is narrow enough. */
+#define SWEEP_MIN_VARS 20
+/** The most variables a sweep may keep track of at once. The values of those
+  * plus one more must fit in 32 bits. */
+#define SWEEP_MAX_LIVE 24
+/** The most states a sweep may reach in one step before it gives up. */
+#define SWEEP_MAX_STATES 65536
+/** The most calls enumerate() may make for one component. */
+#define ENUM_MAX_STEPS 16000000L
+/** Sets of variables no bigger than this are enumerated without splitting. */
+#define SPLIT_MIN_VARS 16
+/** The deepest that count_vars() splits sets. */
+#define SPLIT_MAX_DEPTH 8
+/** The number of hash buckets in the component cache. */
+#define CACHE_BUCKETS 1024
+/** The most numbers the component cache may hold before it is emptied. */
+#define CACHE_MAX_DOUBLES 4000000L
+/** The number of ints describing each constraint in a component key. */
+#define KEY_CON_INTS 10
+/** The most hidden tiles there can be around a pair of adjacent numbers. */
+#define PATTERN_CELLS 10
+/** The window tiles around the first and the second number of a pair. */
+#define PATTERN_FIRST 0x1D7
+#define PATTERN_SECOND 0x3AE
+/** Board generation options, as bits of g_gen: boards that can be solved
+  * without guessing from the first click... */
+#define GEN_NOGUESS 1
+/** ...first reveals that clear the tiles around them too... */
+#define GEN_OPENING 2
+/** ...and boards whose stats fall within g_range. */
+#define GEN_RANGE 4
+/** The most boards generate() draws looking for one within g_range. */
+#define RANGE_MAX_TRIES 100000L
+/** The seconds between the checkpoints search_seeds() writes. */
+#define CHECKPOINT_INTERVAL 10
+/** The most mines make_solvable() moves before it settles for the board. */
+#define NOGUESS_MAX_MOVES 2000
+/** The number of chains that sample_probabilities() runs. */
+#define SAMPLE_CHAINS 4
+/** The number of variables sample_probabilities() rearranges at once. */
+#define SAMPLE_BLOCK 12
+/** The number of samples in a batch for estimating standard errors. */
+#define SAMPLE_BATCH 16
+/** The number of conflicts before the SAT solver first restarts. */
+#define SAT_RESTART 100
+/** The number of bits in an unsigned long. */
+#define LONG_BITS (sizeof(unsigned long) * CHAR_BIT)
+/** The number of unsigned longs in a set of tiles. */
+#define SET_WORDS ((MAX_TILES + LONG_BITS - 1) / LONG_BITS)
 /** Maximum command length excluding NUL. */
 #define CMD_MAX 7
+/** The journal is flushed after this many commands have been appended... */
+#define JOURNAL_BATCH 16
+/** ...or after this many seconds have passed since the last flush. */
+#define JOURNAL_INTERVAL 1
+/** The replay file magic number. */
+#define REPLAY_MAGIC "MNRP"
+/** The replay file format version. */
+#define REPLAY_VERSION 1
+/** Replay header flag: each move is followed by the seconds since the last. */
+#define REPLAY_TIMES 1
+/** The header flags hold g_gen shifted left this far. With GEN_RANGE, the
+  * flags are followed by the six bounds of g_range. */
+#define REPLAY_GEN_SHIFT 1
+/** Replay record kinds, stored in the low three bits of each record. */
+#define REPLAY_REVEAL 0
+#define REPLAY_FLAG 1
+#define REPLAY_KEYFRAME 2
+/** An undo or redo: the record holds the number of changes, and each change
+  * follows as a tile index shifted left one, or'd with one for a flag toggle
+  * rather than a reveal. */
+#define REPLAY_UNDO 3
+#define REPLAY_REDO 4
+/** The number of moves between replay keyframes. */
+#define REPLAY_KEYFRAME_INTERVAL 64
+/** The corpus file magic number, and the magic number ending its index. */
+#define CORPUS_MAGIC "MNCP"
+#define CORPUS_INDEX_MAGIC "MNCI"
+/** The corpus file format version. */
+#define CORPUS_VERSION 1
+/** Corpus header flags: each board also has its numbers, four bits a tile... */
+#define CORPUS_AROUND 1
+/** ...its 3BV, openings, largest opening and isolated numbers... */
+#define CORPUS_STATS 2
+/** ...and, instead of a bit for each tile, the gaps between the tiles with
+  * mines in Rice codes. The header ends with the Rice parameter. */
+#define CORPUS_RICE 4
+/** With CORPUS_RICE, the gaps are between the tiles without mines instead,
+  * as there are fewer of them. */
+#define CORPUS_SAFE_GAPS 8
+/** The largest Rice parameter, which suits gaps of hundreds of tiles. */
+#define RICE_MAX 10
+/** The number of boards in each block of the corpus index. */
+#define CORPUS_BLOCK 4096
+/** The bytes of output buffered for the corpus. */
+#define CORPUS_BUFFER 65536
+/** The slots g_seen starts with. It doubles whenever half are used. */
+#define SEEN_MIN_SLOTS 1024
+/** A linear equation over frontier variables whose coefficients are all -1, 0
+  * or 1. */
+struct row {
+	/* The variables with coefficient 1 and those with coefficient -1. */
+	unsigned long pos[SET_WORDS], neg[SET_WORDS];
+	/* The value of the sum. */
+	int sum;
+};
+
 /** The capital alphabet; the standard does not guarantee that the integer
   * values of the characters are sequential. */
 static const char alphabet[MAX_WIDTH] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -43,7 +180,93 @@ static const char alphabet[MAX_WIDTH] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
   * quarter cycle to accommodate cosine calculations. */
 static const signed char sines[] = {0, 1, 1, 1, 0, -1, -1, -1, 0, 1};
 
+/** One step of a sweep: how to assign one variable. */
+struct sweep_step {
+	/* The number of live variables before the step. */
+	int n_live;
+	/* For each constraint of the variable: the mask of the constraint's
+	 * assigned variables among the live ones and the new one (the bit
+	 * after the live ones), the mines it needs, and how many of its
+	 * variables are still unassigned after the step. */
+	int n_cons;
+	unsigned long con_mask[8];
+	int need[8], left[8];
+	/* The bits kept as live variables after the step, in order. */
+	int n_keep;
+	int keep[SWEEP_MAX_LIVE + 1];
+};
+
+/** A set of assignments of the live variables reached by a sweep. */
+struct sweep_state {
+	/* The values of the live variables. */
+	unsigned long mask;
+	/* The least number of mines among the assigned variables, and how many
+	 * counts follow. */
+	int k_min, k_len;
+	/* The offset in the arena of the counts of the ways to reach this state
+	 * with k_min mines, k_min + 1 mines, and so on. */
+	long at;
+};
+
+/** A component solved by sweeping along one axis. */
+struct sweep {
+	/* The number of variables. */
+	int n;
+	/* The variables in the order they are assigned. */
+	int order[MAX_TILES];
+	/* How to assign each variable. */
+	struct sweep_step steps[MAX_TILES];
+	/* The states reached after assigning each number of variables, sorted
+	 * by mask. */
+	struct sweep_state *states[MAX_TILES + 1];
+	int n_states[MAX_TILES + 1];
+	/* Where the counts of states are kept. */
+	double *arena;
+	long arena_len, arena_cap;
+};
+
+/** The counts of a component, saved to be reused whenever a component with the
+  * same shape and numbers comes up again. */
+struct cache_entry {
+	/* The next entry in the same bucket. */
+	struct cache_entry *next;
+	/* The hash and the whole of the key. */
+	unsigned long hash;
+	int *key, key_len;
+	/* The number of variables, and the counts as count_component() gives
+	 * them with the variables in key order, or null if counting took too
+	 * many steps. */
+	int n;
+	double *counts, *tile_counts;
+};
+
+/** The bounds of the board stats asked for, inclusive. */
+struct stats_range {
+	int min_3bv, max_3bv;
+	int min_openings, max_openings;
+	int min_largest, max_largest;
+};
+
+/** How hard a board is to clear. */
+struct board_stats {
+	/* The fewest clicks that reveal every tile without a mine: one for each
+	 * opening and one for each isolated number. */
+	int three_bv;
+	/* The number of openings, which are connected areas of tiles with no
+	 * mines around them, and the tiles the largest reveals in one click. */
+	int n_openings, largest_opening;
+	/* The number of numbered tiles not on the edge of any opening. */
+	int n_isolated;
+};
+
 /* GLOBAL STATE */
+/** The component cache: its buckets, the numbers it holds, and how often it
+  * has been looked in with and without success. */
+static struct {
+	struct cache_entry *buckets[CACHE_BUCKETS];
+	long n_doubles;
+	unsigned long hits, misses;
+} g_cache;
 /** The text printed before the board is drawn each time. */
 static const char *g_separator = "\n\n\n\n";
 /** Whether or not board_init has been called at least once. */
@@ -58,14 +281,228 @@ static int g_n_mines = 40;
 static int g_n_flags = 0;
 /** The number of flagged tiles which contain mines. */
 static int g_n_found = 0;
-/** The grid of tiles. Index with g_board[x][y]. */
-static struct tile g_board[MAX_WIDTH][MAX_HEIGHT];
+/** The seed from which the board is generated. */
+static unsigned long g_seed;
+/** Whether g_seed was set by the -seed option rather than the clock. */
+static int g_seed_given = 0;
+/** The board generation options, a combination of the GEN_ bits. */
+static int g_gen = 0;
+/** With GEN_RANGE, the stats the board must have. */
+static struct stats_range g_range = {
+	0, MAX_TILES, 0, MAX_TILES, 0, MAX_TILES
+};
+/** How many numbers have been drawn from the seed by random_below(). */
+static unsigned long g_n_draws = 0;
+/** Whether to suppress printing the board and command messages. Set while
+  * recovering from the journal. */
+static int g_quiet = 0;
+/** The path of the journal file, or NULL if there is no journal. */
+static const char *g_journal_path = NULL;
+/** The open journal, or NULL if commands are not currently being journaled. */
+static FILE *g_journal = NULL;
+/** The number of commands appended to g_journal since it was last flushed. */
+static int g_journal_pending = 0;
+/** The time g_journal was last flushed. */
+static time_t g_journal_flushed;
+/** The file moves are recorded to, or NULL if the game is not recorded. */
+static FILE *g_record = NULL;
+/** The path of the file to record to, or NULL. */
+static const char *g_record_path = NULL;
+/** The first and last seeds search_seeds() looks through, and whether it
+  * was asked to. */
+static unsigned long g_search_first, g_search_last;
+static int g_search = 0;
+/** The first reveal search_seeds() makes boards for, or NULL for the middle
+  * of the board. */
+static const char *g_search_from = NULL;
+/** The file search_seeds() saves its progress to, or NULL. */
+static const char *g_checkpoint_path = NULL;
+/** Whether to print board_stats() with the score. */
+static int g_show_stats = 0;
+/** Whether chording keeps chording the numbers it satisfies. */
+static int g_cascade = 0;
+/** Whether to record the time of each move. */
+static int g_record_times = 0;
+/** The time the last move was recorded. */
+static time_t g_record_last;
+/** The number of moves recorded so far. */
+static long g_n_recorded = 0;
+/** The changes made by past moves, for undo and redo. Each is a tile index
+  * shifted left one, or'd with one for a flag toggle rather than a reveal. */
+static unsigned short *g_changes = NULL;
+/** The number of changes in g_changes, including ones that were undone. */
+static int g_n_changes = 0;
+/** The number of changes g_changes has room for. */
+static int g_changes_cap = 0;
+/** The index in g_changes of the first change of each move. */
+static int *g_moves = NULL;
+/** The number of moves in g_moves, including ones that were undone. */
+static int g_n_moves = 0;
+/** The number of moves g_moves has room for. */
+static int g_moves_cap = 0;
+/** The number of moves currently done, that is, not undone. */
+static int g_n_done = 0;
+/** Whether the changes being made belong to a move already in g_moves. */
+static int g_in_move = 0;
+/** Whether to keep track of changes at all. Not needed for replays. */
+static int g_keep_changes = 1;
+/** Revealed tiles the solver has yet to check, as indices y * g_width + x. */
+static int g_work[MAX_WIDTH * MAX_HEIGHT];
+/** The number of tiles in g_work. */
+static int g_n_work = 0;
+/** Whether each tile is in g_work. Index with g_in_work[y][x]. */
+static char g_in_work[MAX_HEIGHT][MAX_WIDTH];
+/** The hidden, unflagged tiles as bit planes: bit x of g_rows[y] and bit y of
+  * g_cols[x] are set for the tile at (x, y). Kept up to date by set_tile(). */
+static unsigned long g_rows[MAX_HEIGHT], g_cols[MAX_WIDTH];
+/** What can be deduced from a pair of adjacent numbers. The index is the
+  * window mask of hidden tiles around the pair as described for
+  * solve_patterns(), then the mines the first and the second number lack
+  * flags for. safe and mine are masks of the window tiles forced either way.
+  * Set up by init_patterns(). */
+static struct {
+	unsigned short safe, mine;
+} g_patterns[1 << PATTERN_CELLS][9][9];
+/** Whether g_patterns is set up. */
+static int g_patterns_ready = 0;
+/** The frontier: hidden, unflagged tiles next to a revealed number, as indices
+  * y * g_width + x in no particular order. Kept up to date by set_tile(). */
+static int g_frontier[MAX_TILES];
+/** The number of tiles in g_frontier. */
+static int g_n_frontier = 0;
+/** Where each tile is in g_frontier, or -1 if it is not there. */
+static int g_frontier_at[MAX_TILES];
+/** The number of tiles neither flagged nor revealed. */
+static int g_n_unknown = 0;
+/** The number of mines in each row, for finding the nth tile without one. */
+static int g_row_mines[MAX_HEIGHT];
+/** Whether the solver is running, so changed tiles should be queued. */
+static int g_solving = 0;
+/** The number of frontier variables: hidden, unflagged tiles next to a revealed
+  * number. Set by build_frontier(). */
+static int g_n_vars;
+/** The tile index of each variable, in an order where each constraint
+  * component is contiguous and breadth-first. */
+static int g_var_tile[MAX_TILES];
+/** The variable of each tile index, or -1. */
+static int g_tile_var[MAX_TILES];
+/** The constraints from revealed numbers with hidden neighbours. */
+static struct constraint g_cons[MAX_TILES];
+/** The number of constraints in g_cons. */
+static int g_n_cons;
+/** The constraints each variable is part of. */
+static int g_var_cons[MAX_TILES][8];
+/** The number of constraints each variable is part of. */
+static int g_var_n_cons[MAX_TILES];
+/** The first variable of each component, plus a final entry of g_n_vars. */
+static int g_comp_start[MAX_TILES + 1];
+/** The number of independent components in the frontier. */
+static int g_n_comps;
+/** The number of hidden, unflagged tiles not next to any revealed number. */
+static int g_n_interior;
+/** The chance of a mine under each tile, as set by mine_probabilities(). */
+static double g_prob[MAX_HEIGHT][MAX_WIDTH];
+/** Whether g_prob holds estimates from sample_probabilities(). */
+static int g_prob_sampled = 0;
+/** The milliseconds sample_probabilities() may take. */
+static int g_sample_time = 1000;
+/** The natural logarithms of the factorials from 0 to MAX_TILES. */
+static double g_log_fact[MAX_TILES + 1];
+/** The path of the replay to play back instead of playing, or NULL. */
+static const char *g_replay_path = NULL;
+/** A replay loaded into memory by load_replay(). */
+static struct {
+	/* The whole file. */
+	unsigned char *data;
+	/* The number of moves. */
+	int n_moves;
+	/* The offset in data of each move. */
+	size_t *moves;
+	/* Seconds from the start of the game to each move, or NULL. */
+	unsigned long *times;
+	/* The number of keyframes. */
+	int n_keyframes;
+	/* The number of moves before each keyframe. */
+	int *keyframe_moves;
+	/* The offset in data of each keyframe's contents. */
+	size_t *keyframe_offsets;
+	/* The number of moves currently applied to g_board. */
+	int at;
+	/* The outcome of the last move applied. */
+	enum outcome outcome;
+} g_replay;
+/** The path of the corpus -search writes boards to, or NULL. */
+static const char *g_corpus_path = NULL;
+/** Whether to write each board's numbers to the corpus. */
+static int g_corpus_around = 0;
+/** Whether to write the mines in the corpus with CORPUS_RICE. */
+static int g_corpus_rice = 0;
+/** The path of a corpus to print or check instead of playing, or NULL. */
+static const char *g_dump_path = NULL;
+static const char *g_verify_path = NULL;
+/** Whether to leave out boards that are symmetric copies of ones before. */
+static int g_dedup = 0;
+/** The fingerprints of the boards seen so far with -dedup, in an open
+  * addressing table. Each slot is two numbers, both 0 if it is empty. */
+static struct {
+	unsigned long *slots;
+	unsigned long n_slots, n_used;
+} g_seen;
+/** The corpus being written by search_seeds() or read by read_corpus(). */
+static struct {
+	FILE *to, *from;
+	/* The CORPUS_ flags and, with CORPUS_RICE, the Rice parameter. */
+	int flags, rice;
+	/* The bits written or read but not yet put out or used, low first,
+	 * and the number of them. */
+	int bits, n_bits;
+	/* The bytes written or read so far, and the boards. */
+	unsigned long at, n_boards;
+	/* The offset of the first board of each block, and the number of them
+	 * in use and room for. */
+	unsigned long *blocks;
+	int n_blocks, cap_blocks;
+} g_corpus;
+/** The grid of tiles. Index with g_board[y][x]. The grid is row-major so that
+  * generation, reveal_all() and print_board() walk memory in order. */
+static struct tile g_board[MAX_HEIGHT][MAX_WIDTH];
 
 /** Trigonometry for the square (not circle) around a tile. These functions are
   * limited; angles must be from 0 to 7, inclusive. */
 #define sine(angle) (sines[(angle)])
 #define cosine(angle) (sines[(angle) + 2])
 
+/** Truncate a number to 32 bits, since unsigned long may be wider. */
+#define U32(n) ((n) & 0xFFFFFFFFUL)
+
+/** Scramble the bits of a 32-bit number. Every input maps to a distinct
+  * output. */
+static unsigned long mix32(unsigned long n)
+{
+	n = U32(n);
+	n ^= n >> 16;
+	n = U32(n * 0x7FEB352DUL);
+	n ^= n >> 15;
+	n = U32(n * 0x846CA68BUL);
+	n ^= n >> 16;
+	return n;
+}
+
+/** Hash the number n under the key. The same key and number always give the
+  * same result, independent of what was hashed before. */
+static unsigned long keyed_hash(unsigned long key, unsigned long n)
+{
+	return mix32(mix32(key ^ 0x9E3779B9UL) + U32(n));
+}
+
+/** Get the next pseudo-random number from 0 to below-1, inclusive. The nth
+  * number drawn depends only on g_seed and n, so the same seed always
+  * generates the same board. */
+static int random_below(int below)
+{
+	return (int)(keyed_hash(g_seed, g_n_draws++) % (unsigned long)below);
+}
+
 /** Print "Usage:..." to the file. */
 static void print_usage(char *progname, FILE *to)
 {
@@ -87,17 +524,41 @@ static void print_help(FILE *to)
 "lowercase letter followed by an optional position. A position is a capital\n"
 "letter indicating a column followed by a positive integer indicating a row.\n"
 "These quantities must fit within the board.\n";
-	const char cmd_list[] =
-"Commands:\n"
-"  <nothing>    Perform no action and print out the board.\n"
+	/* One string per command, to keep them short enough for C89. */
+	static const char *const cmd_list[] = {
+"  <nothing>    Perform no action and print out the board.\n",
 "  r<position>  Reveal <position>. If a mine is there, you're dead.\n"
-"  <position>   Same as r<position>.\n"
+"  <position>   Same as r<position>.\n",
 "  f<position>  Toggle the flag at <position>. Nothing happens if the tile is\n"
-"               already revealed.\n"
-"  ?            Print this help information.\n"
+"               already revealed.\n",
+"  c<position>  Chord <position>: if it is a number with that many flags\n"
+"               around it, reveal its other neighbours. Flags are assumed\n"
+"               correct.\n"
+"  cc<position> Chord <position>, then chord every number that leaves with\n"
+"               all its flags, until there are none.\n",
+"  u            Undo the last reveal or flag.\n"
+"  y            Redo the last move undone.\n",
+"  s            Make every move that follows from the numbers: reveal around\n"
+"               numbers with all their flags, flag around numbers with just\n"
+"               enough hidden tiles, then look up what pairs of adjacent\n"
+"               numbers force, then do the same with sums and differences\n"
+"               of numbers, then search for tiles every arrangement of\n"
+"               mines agrees on. Flags are assumed correct.\n",
+"  p            Show the exact chance of a mine under each hidden tile, in\n"
+"               tenths, with S for safe and M for mine. If that would take\n"
+"               too long, the chances are estimated by sampling instead.\n"
+"               Parts of the frontier seen before, anywhere on the board,\n"
+"               are not counted again.\n",
+"  ?            Print this help information.\n",
 "  q            Quit the game. You will have to confirm your quitting unless\n"
-"               you have yet to perform any action.\n";
-	fprintf(to, "\n%s\n%s\n%s", game_overview, cmd_overview, cmd_list);
+"               you have yet to perform any action.\n",
+		NULL
+	};
+	int i;
+	fprintf(to, "\n%s\n%s\nCommands:\n", game_overview, cmd_overview);
+	for (i = 0; cmd_list[i]; ++i) {
+		fputs(cmd_list[i], to);
+	}
 }
 
 /** Print help to the file in response to "-help" or equivalent. The program
@@ -110,6 +571,61 @@ static void print_shell_help(char *progname, FILE *to)
 "  -separator <text>  Print <text> between frames. The default is a few\n"
 "                     newlines. You can clear the screen between frames with\n"
 "                     ANSI escape sequences using separator <ESC>[H<ESC>[J.\n";
+	/* Each option is a separate string to keep them all short enough for
+	 * C89 compilers. */
+	static const char *const extra_opts[] = {
+"  -stats             Print the 3BV of the board, which is the fewest clicks\n"
+"                     that clear it, and its openings and isolated numbers\n"
+"                     with the score.\n",
+"  -opening           Keep the tiles around the first reveal free of mines\n"
+"                     too, so that it opens an area.\n"
+"  -noguess           Make boards that can be solved from the first reveal\n"
+"                     without guessing.\n",
+"  -3bv <min>-<max>   Make boards with a 3BV between <min> and <max>.\n"
+"  -openings <min>-<max>\n"
+"                     Make boards with between <min> and <max> openings.\n"
+"  -largest <min>-<max>\n"
+"                     Make boards whose largest opening reveals between <min>\n"
+"                     and <max> tiles.\n",
+"  -search <first>-<last>\n"
+"                     Instead of playing, print the seeds from <first> to\n"
+"                     <last> whose boards are in the ranges above and, with\n"
+"                     -noguess, solvable. Each is printed with its 3BV,\n"
+"                     openings, largest opening and isolated numbers.\n"
+"  -first <position>  Search for boards with the first reveal at <position>.\n"
+"                     The default is the middle of the board.\n",
+"  -checkpoint <file> Save the progress of -search to <file> every few\n"
+"                     seconds. If <file> exists, the search carries on from\n"
+"                     the seed after the last it saved. The file is deleted\n"
+"                     when the search ends.\n",
+"  -corpus <file>     Write the boards -search finds to the binary <file>\n"
+"                     instead, each as its seed and a bit for each tile with\n"
+"                     a mine. With -stats, the stats are written too.\n"
+"  -around            Also write the number on each tile to the corpus.\n"
+"  -rice              Write the mines to the corpus as the gaps between them\n"
+"                     in Rice codes, which takes fewer bits than tiles.\n",
+"  -dump <file>       Print each board in the corpus <file> and exit.\n"
+"  -verify <file>     Make each board in the corpus <file> again from its\n"
+"                     seed, check it matches, and exit.\n"
+"  -dedup             Leave out boards that are the same as one before when\n"
+"                     turned or mirrored, from -search and -dump. -verify\n"
+"                     counts them.\n",
+"  -journal <file>    Log every move to <file> so that the game can be\n"
+"                     recovered if the program dies. If <file> already holds\n"
+"                     an unfinished game, that game is resumed and the other\n"
+"                     board options are ignored. The file is deleted when the\n"
+"                     game ends.\n",
+"  -record <file>     Record the game to the replay <file>.\n"
+"  -timestamps        Also record the time of each move.\n"
+"  -cascade           Make c<position> act like cc<position>.\n"
+"  -budget <ms>       Spend <ms> milliseconds sampling when p estimates\n"
+"                     chances. The default is 1000.\n",
+"  -replay <file>     Play back the replay <file> instead of playing. The last\n"
+"                     move is shown, then commands n, p, g<number> and q step\n"
+"                     forward, step back, go to a move and quit.\n",
+		NULL
+	};
+	int i;
 	static char help_str[] =
 "\n"
 "A mine finding game.\n"
@@ -118,10 +634,16 @@ static void print_shell_help(char *progname, FILE *to)
 "%s" /* Misc. options go here */
 "  -width <number>    Set the board width to <number> (between %d and %d.)\n"
 "  -height <number>   Set the board height to <number> (between %d and %d.)\n"
-"  -mines <number>    Set the mine count to <number> (between %d and %d.)\n";
+"  -mines <number>    Set the mine count to <number> (between %d and %d.)\n"
+"  -seed <number>     Generate the board from <number>. The same seed and board\n"
+"                     settings always give the same game. The default seed is\n"
+"                     taken from the clock.\n";
 	print_usage(progname, to);
 	fprintf(to, help_str, misc_opts, MIN_WIDTH, MAX_WIDTH,
 		MIN_HEIGHT, MAX_HEIGHT, MIN_MINES, MAX_MINES);
+	for (i = 0; extra_opts[i]; ++i) {
+		fputs(extra_opts[i], to);
+	}
 	print_help(to);
 }
 
@@ -163,6 +685,61 @@ static int number_arg(char *argv[], int *i, int min, int max)
 	return -1;
 }
 
+/** Get the string argv[*i+1] for the option argv[*i], which has the usage
+  * "<option> <what>". If it is missing, an error is printed and the program
+  * halts. Otherwise, *i is incremented and the string is returned. */
+static char *string_arg(char *argv[], int *i, const char *what)
+{
+	char *opt = argv[*i];
+	char *arg = argv[++*i];
+	if (!arg) {
+		fprintf(stderr, "%s: Usage: %s <%s>\n", argv[0], opt, what);
+		exit(EXIT_FAILURE);
+	}
+	return arg;
+}
+
+/** Parse a range "<min>-<max>" from the string argv[*i+1] into *min and *max,
+  * with 0 <= *min <= *max <= MAX_TILES. If something goes wrong, an error is
+  * printed and the program halts. If all goes well, *i is incremented. */
+static void range_arg(char *argv[], int *i, int *min, int *max)
+{
+	char *opt = argv[*i];
+	char *arg = string_arg(argv, i, "min>-<max");
+	char *end;
+	long lo, hi;
+	lo = strtol(arg, &end, 10);
+	if (end == arg || *end != '-') goto bad;
+	arg = end + 1;
+	hi = strtol(arg, &end, 10);
+	if (end == arg || *end != '\0') goto bad;
+	if (lo < 0 || lo > hi || hi > MAX_TILES) {
+		fprintf(stderr, "%s: %s must be a range within 0-%d\n",
+			argv[0], opt + 1, MAX_TILES);
+		exit(EXIT_FAILURE);
+	}
+	*min = (int)lo;
+	*max = (int)hi;
+	return;
+bad:
+	fprintf(stderr, "%s: Usage: %s <min>-<max>\n", argv[0], opt);
+	exit(EXIT_FAILURE);
+}
+
+/** Parse a seed from the string arg into *seed. If it is not a number, an
+  * error is printed and the program halts. The rest of the string is
+  * returned. */
+static char *seed_arg(const char *progname, char *arg, unsigned long *seed)
+{
+	char *end;
+	*seed = U32(strtoul(arg, &end, 10));
+	if (end == arg) {
+		fprintf(stderr, "%s: seed must be a number\n", progname);
+		exit(EXIT_FAILURE);
+	}
+	return end;
+}
+
 /** Parse the options given the arguments. Initializes all the global state.
   * This must be called before all the other functions. */
 static void parse_options(int argc, char *argv[])
@@ -182,20 +759,77 @@ static void parse_options(int argc, char *argv[])
 			print_version(progname, stdout);
 			exit(EXIT_SUCCESS);
 		} else if (!strcmp(opt, "-separator")) {
-			++i;
-			if (!argv[i]) {
-				fprintf(stderr,
-					"%s: Usage: -separator <text>\n",
-					progname);
+			g_separator = string_arg(argv, &i, "text");
+		} else if (!strcmp(opt, "-journal")) {
+			g_journal_path = string_arg(argv, &i, "file");
+		} else if (!strcmp(opt, "-record")) {
+			g_record_path = string_arg(argv, &i, "file");
+		} else if (!strcmp(opt, "-stats")) {
+			g_show_stats = 1;
+		} else if (!strcmp(opt, "-opening")) {
+			g_gen |= GEN_OPENING;
+		} else if (!strcmp(opt, "-noguess")) {
+			g_gen |= GEN_NOGUESS;
+		} else if (!strcmp(opt, "-3bv")) {
+			range_arg(argv, &i, &g_range.min_3bv, &g_range.max_3bv);
+			g_gen |= GEN_RANGE;
+		} else if (!strcmp(opt, "-openings")) {
+			range_arg(argv, &i, &g_range.min_openings,
+				&g_range.max_openings);
+			g_gen |= GEN_RANGE;
+		} else if (!strcmp(opt, "-largest")) {
+			range_arg(argv, &i, &g_range.min_largest,
+				&g_range.max_largest);
+			g_gen |= GEN_RANGE;
+		} else if (!strcmp(opt, "-search")) {
+			char *arg = string_arg(argv, &i, "first>-<last");
+			char *end = seed_arg(progname, arg, &g_search_first);
+			if (*end != '-'
+			 || *seed_arg(progname, end + 1, &g_search_last) != '\0'
+			 || g_search_first > g_search_last) {
+				fprintf(stderr, "%s: Usage: %s <first>-<last>\n",
+					progname, opt);
 				exit(EXIT_FAILURE);
 			}
-			g_separator = argv[i];
+			g_search = 1;
+		} else if (!strcmp(opt, "-first")) {
+			g_search_from = string_arg(argv, &i, "position");
+		} else if (!strcmp(opt, "-checkpoint")) {
+			g_checkpoint_path = string_arg(argv, &i, "file");
+		} else if (!strcmp(opt, "-corpus")) {
+			g_corpus_path = string_arg(argv, &i, "file");
+		} else if (!strcmp(opt, "-around")) {
+			g_corpus_around = 1;
+		} else if (!strcmp(opt, "-rice")) {
+			g_corpus_rice = 1;
+		} else if (!strcmp(opt, "-dedup")) {
+			g_dedup = 1;
+		} else if (!strcmp(opt, "-dump")) {
+			g_dump_path = string_arg(argv, &i, "file");
+		} else if (!strcmp(opt, "-verify")) {
+			g_verify_path = string_arg(argv, &i, "file");
+		} else if (!strcmp(opt, "-cascade")) {
+			g_cascade = 1;
+		} else if (!strcmp(opt, "-timestamps")) {
+			g_record_times = 1;
+		} else if (!strcmp(opt, "-budget")) {
+			g_sample_time = number_arg(argv, &i, 1, 3600000);
+		} else if (!strcmp(opt, "-replay")) {
+			g_replay_path = string_arg(argv, &i, "file");
 		} else if (!strcmp(opt, "-width")) {
 			g_width = number_arg(argv, &i, MIN_WIDTH, MAX_WIDTH);
 		} else if (!strcmp(opt, "-height")) {
 			g_height = number_arg(argv, &i, MIN_HEIGHT, MAX_HEIGHT);
 		} else if (!strcmp(opt, "-mines")) {
 			g_n_mines = number_arg(argv, &i, MIN_MINES, MAX_MINES);
+		} else if (!strcmp(opt, "-seed")) {
+			char *arg = string_arg(argv, &i, "number");
+			if (*seed_arg(progname, arg, &g_seed) != '\0') {
+				fprintf(stderr, "%s: seed must be a number\n",
+					progname);
+				exit(EXIT_FAILURE);
+			}
+			g_seed_given = 1;
 		} else if (*opt == '-') {
 			fprintf(stderr, "%s: Unrecognized option: %s\n",
 				progname, opt);
@@ -209,7 +843,78 @@ static void parse_options(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 	}
+	if (g_corpus_path && (!g_search || g_checkpoint_path)) {
+		fprintf(stderr, "%s: -corpus needs -search, and cannot be used"
+			" with -checkpoint\n", progname);
+		exit(EXIT_FAILURE);
+	}
 	if (g_n_mines > g_width * g_height) g_n_mines = g_width * g_height;
+	if (!g_seed_given) g_seed = U32((unsigned long)time(NULL));
+}
+
+/** Grow the array buf of *cap items of the given size so that it holds at
+  * least need items. The possibly moved array is returned. The program halts
+  * if memory runs out. */
+static void *grow(void *buf, int *cap, int need, size_t size)
+{
+	int new_cap;
+	if (need <= *cap) return buf;
+	new_cap = *cap * 2 > need ? *cap * 2 : need + 16;
+	buf = realloc(buf, (size_t)new_cap * size);
+	if (!buf) {
+		fputs("Out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	*cap = new_cap;
+	return buf;
+}
+
+/** Start a new move. The changes made until the next call will be undone
+  * together. Nothing is added to the history until a change is made. */
+static void begin_move(void)
+{
+	g_in_move = 0;
+}
+
+/** Add (x, y) and the tiles around it to g_work if they are revealed numbers
+  * not already queued. Only these can allow new deductions after (x, y)
+  * changes. */
+static void queue_around(int x, int y)
+{
+	int angle;
+	for (angle = 0; angle <= 8; ++angle) {
+		/* Angle 8 is the tile itself. */
+		int ax = angle < 8 ? x + cosine(angle) : x;
+		int ay = angle < 8 ? y + sine(angle) : y;
+		struct tile *t;
+		if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height)
+			continue;
+		t = &g_board[ay][ax];
+		if (t->revealed && !t->mine && t->around > 0
+		 && !g_in_work[ay][ax]) {
+			g_in_work[ay][ax] = 1;
+			g_work[g_n_work++] = ay * g_width + ax;
+		}
+	}
+}
+
+/** Remember that the tile at (x, y) was revealed, or had its flag toggled if
+  * flag is nonzero. The first change of a move forgets all undone moves. */
+static void add_change(int x, int y, int flag)
+{
+	if (g_solving) queue_around(x, y);
+	if (!g_keep_changes) return;
+	if (!g_in_move) {
+		if (g_n_done < g_n_moves) g_n_changes = g_moves[g_n_done];
+		g_moves = grow(g_moves, &g_moves_cap, g_n_done + 1,
+			sizeof(*g_moves));
+		g_moves[g_n_done++] = g_n_changes;
+		g_n_moves = g_n_done;
+		g_in_move = 1;
+	}
+	g_changes = grow(g_changes, &g_changes_cap, g_n_changes + 1,
+		sizeof(*g_changes));
+	g_changes[g_n_changes++] = (unsigned short)((y * g_width + x) << 1 | flag);
 }
 
 /** Add the quantity to the 'around' field of each tile around (x, y) */
@@ -220,53 +925,328 @@ static void add_around(int x, int y, int add)
 		int ax = x + cosine(angle);
 		int ay = y + sine(angle);
 		if (ax >= 0 && ax < g_width && ay >= 0 && ay < g_height) {
-			g_board[ax][ay].around += add;
+			g_board[ay][ax].around += add;
 		}
 	}
 }
 
-/** If g_board_initialized is 0, initialize g_board and set g_board_initialized.
-  * All tiles are concealed and g_n_mines random tiles are given mines. */
-static void init_board(void)
+/** Put the tile at (x, y) in g_frontier if it belongs there, or take it out if
+  * not. */
+static void update_frontier(int x, int y)
+{
+	struct tile *t = &g_board[y][x];
+	int i = y * g_width + x, at = g_frontier_at[i];
+	if (!t->revealed && !t->flagged && t->numbers_around > 0) {
+		if (at >= 0) return;
+		g_frontier_at[i] = g_n_frontier;
+		g_frontier[g_n_frontier++] = i;
+	} else if (at >= 0) {
+		int last = g_frontier[--g_n_frontier];
+		g_frontier[at] = last;
+		g_frontier_at[last] = at;
+		g_frontier_at[i] = -1;
+	}
+}
+
+/** Set whether the tile at (x, y) is revealed and flagged. The counts kept in
+  * the tiles around it and the frontier are updated to match, in time
+  * independent of the board size. */
+static void set_tile(int x, int y, int revealed, int flagged)
+{
+	struct tile *t = &g_board[y][x];
+	int flag = !t->revealed && t->flagged;
+	int unknown = !t->revealed && !t->flagged;
+	int number = t->revealed && !t->mine;
+	int angle;
+	t->revealed = revealed;
+	t->flagged = flagged;
+	flag = (!t->revealed && t->flagged) - flag;
+	unknown = (!t->revealed && !t->flagged) - unknown;
+	number = (t->revealed && !t->mine) - number;
+	g_n_unknown += unknown;
+	if (!revealed && !flagged) {
+		g_rows[y] |= 1UL << x;
+		g_cols[x] |= 1UL << y;
+	} else {
+		g_rows[y] &= ~(1UL << x);
+		g_cols[x] &= ~(1UL << y);
+	}
+	for (angle = 0; angle < 8; ++angle) {
+		int ax = x + cosine(angle);
+		int ay = y + sine(angle);
+		struct tile *a;
+		if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height)
+			continue;
+		a = &g_board[ay][ax];
+		a->flags_around += flag;
+		a->unknown_around += unknown;
+		a->numbers_around += number;
+		if (number) update_frontier(ax, ay);
+	}
+	update_frontier(x, y);
+}
+
+/** Work out the counts kept in each tile, g_frontier, g_n_unknown, g_rows,
+  * g_cols and g_row_mines afresh from the board, and forget the variables of
+  * the last build_frontier(). This is for when the whole board changes at
+  * once. */
+static void recount_around(void)
+{
+	int x, y, angle;
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			struct tile *t = &g_board[y][x];
+			t->flags_around = t->unknown_around = 0;
+			t->numbers_around = 0;
+			g_frontier_at[y * g_width + x] = -1;
+			g_tile_var[y * g_width + x] = -1;
+		}
+	}
+	g_n_frontier = g_n_unknown = g_n_vars = 0;
+	for (x = 0; x < g_width; ++x) {
+		g_cols[x] = 0;
+	}
+	for (y = 0; y < g_height; ++y) {
+		g_row_mines[y] = 0;
+		g_rows[y] = 0;
+		for (x = 0; x < g_width; ++x) {
+			struct tile *t = &g_board[y][x];
+			g_n_unknown += !t->revealed && !t->flagged;
+			if (!t->revealed && !t->flagged) {
+				g_rows[y] |= 1UL << x;
+				g_cols[x] |= 1UL << y;
+			}
+			g_row_mines[y] += t->mine;
+			for (angle = 0; angle < 8; ++angle) {
+				int ax = x + cosine(angle);
+				int ay = y + sine(angle);
+				struct tile *a;
+				if (ax < 0 || ax >= g_width
+				 || ay < 0 || ay >= g_height)
+					continue;
+				a = &g_board[ay][ax];
+				a->flags_around += !t->revealed && t->flagged;
+				a->unknown_around += !t->revealed && !t->flagged;
+				a->numbers_around += t->revealed && !t->mine;
+			}
+		}
+	}
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			update_frontier(x, y);
+		}
+	}
+}
+
+/** Hide every tile and take away the mines, leaving the board to be generated
+  * again. */
+static void clear_board(void)
+{
+	static const struct tile blank;
+	int x, y;
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			g_board[y][x] = blank;
+		}
+	}
+	recount_around();
+	g_board_initialized = 0;
+}
+
+/* Defined with the SAT solver, whose clauses hold the numbers. */
+static void sat_reset(void);
+
+/** Give g_n_mines random tiles on a board with no mines mines, and count the
+  * mines around each tile and in each row. The other counts are unchanged.
+  * The SAT solver is reset, as the numbers it was given no longer hold. */
+static void place_mines(void)
 {
 	int i, x, y;
-	if (g_board_initialized) return;
-	g_board_initialized = 1;
+	sat_reset();
 	for (i = x = y = 0; i < g_n_mines; ++i) {
-		g_board[x][y].mine = 1;
+		g_board[y][x].mine = 1;
 		if (++x >= g_width) {
 			x = 0;
 			++y;
 		}
 	}
-	srand((unsigned)time(NULL));
 	for (i = x = y = 0; i < g_n_mines; ++i) {
-		struct tile temp, *there;
-		temp = g_board[x][y];
-		there = &g_board[rand() % g_width][rand() % g_height];
-		g_board[x][y] = *there;
-		*there = temp;
+		struct tile *there;
+		int tx, ty, mine;
+		/* Drawn separately so the order of draws is fixed. */
+		tx = random_below(g_width);
+		ty = random_below(g_height);
+		/* Only the mines are swapped, so the other counts stay put. */
+		there = &g_board[ty][tx];
+		mine = g_board[y][x].mine;
+		g_board[y][x].mine = there->mine;
+		there->mine = mine;
 		if (++x >= g_width) {
 			x = 0;
 			++y;
 		}
 	}
+	for (y = 0; y < g_height; ++y) {
+		g_row_mines[y] = 0;
+		for (x = 0; x < g_width; ++x) {
+			if (!g_board[y][x].mine) continue;
+			add_around(x, y, 1);
+			++g_row_mines[y];
+		}
+	}
+}
+
+/** Take the mines off the board, leaving the rest as it is. */
+static void clear_mines(void)
+{
+	int x, y;
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			g_board[y][x].mine = 0;
+			g_board[y][x].around = 0;
+		}
+	}
+}
+
+/** If g_board_initialized is 0, initialize g_board and set g_board_initialized.
+  * All tiles are concealed and g_n_mines random tiles are given mines. Flags
+  * placed before are kept, and the mines under them counted. */
+static void init_board(void)
+{
+	int x, y;
+	if (g_board_initialized) return;
+	g_board_initialized = 1;
+	place_mines();
+	recount_around();
+	g_n_found = 0;
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			g_n_found += g_board[y][x].flagged & g_board[y][x].mine;
+		}
+	}
+}
+
+/** Get the root of tile i in the union-find forest parent, halving the path
+  * on the way. */
+static int find_root(int *parent, int i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+/** Work out the stats of the board from its mines. The openings are labeled in
+  * one pass in reading order, joining each tile with no mines around it to
+  * the ones before it next to it; a second pass sizes them and finds the
+  * isolated numbers. Both take time proportional to the board's area.
+  *
+  * If range is not NULL, -1 is returned as soon as the stats cannot fall
+  * within it, leaving *st unfinished: the openings are known after the first
+  * pass, and the 3BV is bounded by the isolated numbers found and the numbers
+  * yet to be looked at during the second. Otherwise 0 is returned. */
+static int board_stats(struct board_stats *st, const struct stats_range *range)
+{
+	static const int back_x[] = {-1, -1, 0, 1}, back_y[] = {0, -1, -1, -1};
+	static int parent[MAX_TILES], size[MAX_TILES];
+	int x, y, i, j;
+	int n_numbers = 0;
+	st->n_openings = st->largest_opening = st->n_isolated = 0;
 	for (y = 0; y < g_height; ++y) {
 		for (x = 0; x < g_width; ++x) {
-			if (g_board[x][y].mine) add_around(x, y, 1);
+			i = y * g_width + x;
+			parent[i] = i;
+			size[i] = 0;
+			if (g_board[y][x].mine) continue;
+			if (g_board[y][x].around) {
+				++n_numbers;
+				continue;
+			}
+			++st->n_openings;
+			for (j = 0; j < 4; ++j) {
+				int ax = x + back_x[j], ay = y + back_y[j];
+				int a, b;
+				if (ax < 0 || ax >= g_width || ay < 0
+				 || g_board[ay][ax].mine || g_board[ay][ax].around)
+					continue;
+				a = find_root(parent, i);
+				b = find_root(parent, ay * g_width + ax);
+				if (a < b) parent[b] = a;
+				if (b < a) parent[a] = b;
+				st->n_openings -= a != b;
+			}
+		}
+	}
+	if (range && (st->n_openings < range->min_openings
+	 || st->n_openings > range->max_openings
+	 || st->n_openings > range->max_3bv
+	 || st->n_openings + n_numbers < range->min_3bv))
+		return -1;
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			int roots[8], n_roots = 0, angle;
+			if (g_board[y][x].mine) continue;
+			if (!g_board[y][x].around) {
+				++size[find_root(parent, y * g_width + x)];
+				continue;
+			}
+			/* A number is revealed with each opening it borders. */
+			for (angle = 0; angle < 8; ++angle) {
+				int ax = x + cosine(angle), ay = y + sine(angle);
+				int root;
+				if (ax < 0 || ax >= g_width || ay < 0
+				 || ay >= g_height || g_board[ay][ax].mine
+				 || g_board[ay][ax].around)
+					continue;
+				root = find_root(parent, ay * g_width + ax);
+				for (j = 0; j < n_roots; ++j) {
+					if (roots[j] == root) break;
+				}
+				if (j == n_roots) {
+					roots[n_roots++] = root;
+					++size[root];
+				}
+			}
+			st->n_isolated += n_roots == 0;
+			--n_numbers;
+			if (range && (st->n_openings + st->n_isolated
+				> range->max_3bv
+			 || st->n_openings + st->n_isolated + n_numbers
+				< range->min_3bv))
+				return -1;
 		}
 	}
+	for (i = 0; i < g_width * g_height; ++i) {
+		struct tile *t = &g_board[i / g_width][i % g_width];
+		if (t->mine || t->around || parent[i] != i) continue;
+		if (size[i] > st->largest_opening) st->largest_opening = size[i];
+	}
+	st->three_bv = st->n_openings + st->n_isolated;
+	if (range && (st->largest_opening < range->min_largest
+	 || st->largest_opening > range->max_largest))
+		return -1;
+	return 0;
+}
+
+/** Print the stats of a board to stdout. */
+static void print_stats(const struct board_stats *st)
+{
+	printf("3BV: %d (%d openings, the largest %d tiles, and %d isolated"
+		" numbers)\n", st->three_bv, st->n_openings,
+		st->largest_opening, st->n_isolated);
 }
 
 /** Reveal all the tiles on the board. */
 static void reveal_all(void)
 {
 	int x, y;
-	for (x = 0; x < g_width; ++x) {
-		for (y = 0; y < g_height; ++y) {
-			g_board[x][y].revealed = 1;
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			g_board[y][x].revealed = 1;
 		}
 	}
+	recount_around();
 }
 
 /** Reveal (x, y) and the contiguous region around it that contains no mines.
@@ -276,23 +1256,26 @@ static void reveal_all(void)
   * explode the stack. */
 static int reveal(int x, int y)
 {
-	if (g_board[x][y].mine) return 0;
-	if (g_board[x][y].revealed) return 1;
-	g_board[x][y].dx = g_board[x][y].dy = 0;
+	if (g_board[y][x].mine) return 0;
+	if (g_board[y][x].revealed) return 1;
+	g_board[y][x].dx = g_board[y][x].dy = 0;
 	for (;;) {
 		struct tile *t;
 	check_tile:
-		t = &g_board[x][y];
-		t->revealed = 1;
+		t = &g_board[y][x];
+		if (!t->revealed) {
+			set_tile(x, y, 1, t->flagged);
+			add_change(x, y, 0);
+		}
 		if (t->around == 0) {
 			for (; t->angle < 8; ++t->angle) {
 				int ax = x + cosine(t->angle);
 				int ay = y + sine(t->angle);
 				if (ax >= 0 && ax < g_width
 				 && ay >= 0 && ay < g_height
-				 && !g_board[ax][ay].revealed) {
-					g_board[ax][ay].dx = x - ax;
-					g_board[ax][ay].dy = y - ay;
+				 && !g_board[ay][ax].revealed) {
+					g_board[ay][ax].dx = x - ax;
+					g_board[ay][ax].dy = y - ay;
 					x = ax;
 					y = ay;
 					goto check_tile;
@@ -314,118 +1297,2787 @@ static void make_space(int x, int y)
 	int ex, ey;
 	int nth;
 	int n_tiles;
-	if (!g_board[x][y].mine) return;
+	if (!g_board[y][x].mine) return;
 	add_around(x, y, -1);
 	n_tiles = g_width * g_height;
 	if (g_n_mines >= n_tiles) return;
-	nth = rand() % (n_tiles - g_n_mines);
+	nth = random_below(n_tiles - g_n_mines);
 	for (ey = 0; ey < g_height; ++ey) {
 		for (ex = 0; ex < g_width; ++ex) {
-			if (!g_board[ex][ey].mine && nth-- <= 0) {
-				g_board[x][y].mine = 0;
-				g_board[ex][ey].mine = 1;
+			if (!g_board[ey][ex].mine && nth-- <= 0) {
+				g_board[y][x].mine = 0;
+				g_board[ey][ex].mine = 1;
 				add_around(ex, ey, 1);
+				--g_row_mines[y];
+				++g_row_mines[ey];
 				return;
 			}
 		}
 	}
 }
 
-/** Get a character representing the tile at (x, y). */
-static int tile_char(int x, int y)
+/** Clear the mines from (x, y) and the tiles around it, for a first reveal
+  * that opens an area. Each mine is moved to a tile drawn uniformly from the
+  * rest of the board without one. The tile is found through g_row_mines in
+  * time proportional to the board's height plus its width, and only the
+  * counts around the tiles changed are updated. If the rest of the board is
+  * full, mines go back around (x, y), though never on it if there is room. */
+static void make_opening(int x, int y)
 {
-	struct tile t = g_board[x][y];
-	if (t.revealed) {
-		if (t.mine) {
-			return '*';
-		} else {
-			if (t.around > 0) {
-				return '0' + t.around;
-			} else {
-				return ' ';
-			}
+	int n_moved = 0, n_free, n_tiles = g_width * g_height;
+	int left = x > 0 ? x - 1 : 0, right = x + 1 < g_width ? x + 1 : x;
+	int top = y > 0 ? y - 1 : 0, bottom = y + 1 < g_height ? y + 1 : y;
+	int ex, ey, nth;
+	for (ey = top; ey <= bottom; ++ey) {
+		for (ex = left; ex <= right; ++ex) {
+			if (!g_board[ey][ex].mine) continue;
+			g_board[ey][ex].mine = 0;
+			add_around(ex, ey, -1);
+			--g_row_mines[ey];
+			++n_moved;
 		}
-	} else if (t.flagged) {
-		return 'F';
-	} else {
-		return '@';
+	}
+	n_free = n_tiles - (g_n_mines - n_moved)
+		- (right - left + 1) * (bottom - top + 1);
+	for (; n_moved > 0 && n_free > 0; --n_moved, --n_free) {
+		nth = random_below(n_free);
+		for (ey = 0; ; ++ey) {
+			int row_free = g_width - g_row_mines[ey];
+			if (ey >= top && ey <= bottom) row_free -= right - left + 1;
+			if (nth < row_free) break;
+			nth -= row_free;
+		}
+		for (ex = 0; ; ++ex) {
+			if (g_board[ey][ex].mine
+			 || (ey >= top && ey <= bottom
+			  && ex >= left && ex <= right))
+				continue;
+			if (nth-- == 0) break;
+		}
+		g_board[ey][ex].mine = 1;
+		add_around(ex, ey, 1);
+		++g_row_mines[ey];
+	}
+	/* The board is too full to keep the area clear. */
+	for (ey = top; ey <= bottom && n_moved > 0; ++ey) {
+		for (ex = left; ex <= right && n_moved > 0; ++ex) {
+			if (g_board[ey][ex].mine || (ex == x && ey == y))
+				continue;
+			g_board[ey][ex].mine = 1;
+			add_around(ex, ey, 1);
+			++g_row_mines[ey];
+			--n_moved;
+		}
+	}
+	if (n_moved > 0) {
+		g_board[y][x].mine = 1;
+		add_around(x, y, 1);
+		++g_row_mines[y];
 	}
 }
 
-/** Print the row of column names "A B C..." to stdout. */
-static void print_column_names(void)
+/** Write n to the file as a variable length number. Seven bits are stored in
+  * each byte, least significant first, and the high bit is set in all the
+  * bytes but the last. */
+static void write_varint(FILE *to, unsigned long n)
 {
-	int x;
-	printf("    ");
-	for (x = 0; x < g_width; ++x) {
-		printf(" %c", alphabet[x]);
+	while (n >= 0x80) {
+		putc((int)(n & 0x7F) | 0x80, to);
+		n >>= 7;
 	}
-	putchar('\n');
+	putc((int)n, to);
 }
 
-/** Print a border to stdout the right width for the board. */
-static void print_horiz_border(void)
+/** Write one bit per tile to the file, taken from the given field of each tile
+  * in row-major order. */
+#define WRITE_PLANE(to, field) do { \
+	int i_, byte_ = 0, n_ = g_width * g_height; \
+	for (i_ = 0; i_ < n_; ++i_) { \
+		byte_ |= g_board[i_ / g_width][i_ % g_width].field << i_ % 8; \
+		if (i_ % 8 == 7 || i_ == n_ - 1) { \
+			putc(byte_, (to)); \
+			byte_ = 0; \
+		} \
+	} \
+} while (0)
+
+/** Start recording the game to g_record_path, if it is set and recording has
+  * not already started. The header holds the board settings and seed. */
+static void start_recording(const char *progname)
 {
-	int x;
-	printf("    -");
-	for (x = 0; x < g_width; ++x) {
-		printf(" -");
+	if (!g_record_path || g_record) return;
+	g_record = fopen(g_record_path, "wb");
+	if (!g_record) {
+		fprintf(stderr, "%s: %s: Could not open replay\n",
+			progname, g_record_path);
+		exit(EXIT_FAILURE);
 	}
-	putchar('\n');
+	fputs(REPLAY_MAGIC, g_record);
+	write_varint(g_record, REPLAY_VERSION);
+	write_varint(g_record, g_width);
+	write_varint(g_record, g_height);
+	write_varint(g_record, g_n_mines);
+	write_varint(g_record, g_seed);
+	write_varint(g_record, (g_record_times ? REPLAY_TIMES : 0)
+		| (unsigned long)g_gen << REPLAY_GEN_SHIFT);
+	if (g_gen & GEN_RANGE) {
+		write_varint(g_record, g_range.min_3bv);
+		write_varint(g_record, g_range.max_3bv);
+		write_varint(g_record, g_range.min_openings);
+		write_varint(g_record, g_range.max_openings);
+		write_varint(g_record, g_range.min_largest);
+		write_varint(g_record, g_range.max_largest);
+	}
+	g_record_last = time(NULL);
 }
 
-/** Print out the board, borders and all. Prints out g_separator first. */
-static void print_board(void)
+/** Finish recording a move, if the game is being recorded. Every
+  * REPLAY_KEYFRAME_INTERVAL moves, a snapshot of the board is also written so
+  * that playback can seek without replaying the whole game. */
+static void end_record(enum outcome outcome)
 {
-	int y;
-	printf("%s", g_separator);
-	print_column_names();
-	print_horiz_border();
-	for (y = 0; y < g_height; ++y) {
-		int x;
-		int row = y + 1;
-		printf("%2d |", row);
-		for (x = 0; x < g_width; ++x) {
-			printf("`%c", tile_char(x, y));
-		}
-		printf("`| %d\n", row);
+	if (!g_record) return;
+	if (g_record_times) {
+		time_t now = time(NULL);
+		write_varint(g_record,
+			(unsigned long)difftime(now, g_record_last));
+		g_record_last = now;
+	}
+	if (++g_n_recorded % REPLAY_KEYFRAME_INTERVAL == 0) {
+		write_varint(g_record, REPLAY_KEYFRAME);
+		write_varint(g_record, outcome);
+		write_varint(g_record, g_n_draws);
+		WRITE_PLANE(g_record, mine);
+		WRITE_PLANE(g_record, revealed);
+		WRITE_PLANE(g_record, flagged);
 	}
-	print_horiz_border();
-	print_column_names();
-	printf("Flags: %d/%d\n", g_n_flags, g_n_mines);
 }
 
-/** Read a line of stdin. Leading whitespace is skipped. If stdin at the EOF, -1
-  * is returned. The number of characters after the whitespace, excluding the
-  * newline, is otherwise returned. The newline is not read into buf with the
-  * rest. If the characters after the whitespace outnumber max, a number larger
-  * than max is returned, but only max characters are read into buf. buf is not
-  * NUL terminated. */
-static int read_input(char *buf, int max)
+/** Record a move of the kind at (x, y) that has just been made, if the game is
+  * being recorded. */
+static void record_move(int kind, int x, int y, enum outcome outcome)
 {
-	int i = 0;
-	int ch;
-	do {
-		ch = getchar();
-		if (ch == '\n' || ch == EOF) goto finished;
-	} while (isspace(ch));
-	for (i = 0; i < max; ++i) {
-		buf[i] = ch;
-		if (ch == '\n' || ch == EOF) goto finished;
-		ch = getchar();
-	}
-	while (ch != '\n' && ch != EOF) {
-		ch = getchar();
-		++i;
+	if (!g_record) return;
+	write_varint(g_record, (unsigned long)(y * g_width + x) << 3 | kind);
+	end_record(outcome);
+}
+
+/** Toggle the flag at (x, y), keeping the flag counts up to date. */
+static void toggle_flag(int x, int y)
+{
+	struct tile *t = &g_board[y][x];
+	if (t->flagged) {
+		--g_n_flags;
+		g_n_found -= t->mine;
+	} else {
+		++g_n_flags;
+		g_n_found += t->mine;
 	}
-finished:
-	if (i == 0 && feof(stdin)) return -1;
-	return i;
+	set_tile(x, y, t->revealed, !t->flagged);
 }
 
-/** Parse a location (e.g. "C12") from input into *x and *y. If the input was
-  * invalid, -1 is returned. */
-static int parse_location(const char *input, int *x, int *y)
+/** Apply the change, a g_changes entry, to the board. A flag change toggles the
+  * flag. A reveal change reveals the tile, or conceals it if undo is nonzero.
+  * The change is recorded in the replay as part of an undo or redo. */
+static void apply_change(int change, int undo)
+{
+	int x = (change >> 1) % g_width, y = (change >> 1) / g_width;
+	if (change & 1) {
+		toggle_flag(x, y);
+	} else {
+		set_tile(x, y, !undo, g_board[y][x].flagged);
+	}
+	if (g_record) write_varint(g_record, (unsigned long)change);
+}
+
+/** Undo the last move that is done. The changes are reverted newest first, so
+  * this takes time proportional to the number of tiles the move changed. */
+static enum outcome undo_move(void)
+{
+	int i, end;
+	if (g_n_done <= 0) return REFUSED;
+	end = g_n_done < g_n_moves ? g_moves[g_n_done] : g_n_changes;
+	--g_n_done;
+	if (g_record) {
+		write_varint(g_record,
+			(unsigned long)(end - g_moves[g_n_done]) << 3
+			| REPLAY_UNDO);
+	}
+	for (i = end; i-- > g_moves[g_n_done]; ) {
+		apply_change(g_changes[i], 1);
+	}
+	end_record(PLAYING);
+	return PLAYING;
+}
+
+/** Redo the last move undone. */
+static enum outcome redo_move(void)
+{
+	int i, end;
+	if (g_n_done >= g_n_moves) return REFUSED;
+	end = g_n_done + 1 < g_n_moves ? g_moves[g_n_done + 1] : g_n_changes;
+	if (g_record) {
+		write_varint(g_record,
+			(unsigned long)(end - g_moves[g_n_done]) << 3
+			| REPLAY_REDO);
+	}
+	for (i = g_moves[g_n_done]; i < end; ++i) {
+		apply_change(g_changes[i], 0);
+	}
+	end_record(PLAYING);
+	++g_n_done;
+	return PLAYING;
+}
+
+/** Toggle the flag at (x, y). Revealed tiles cannot be flagged. Before the
+  * first reveal there are no mines yet, so only the flag is set. */
+static enum outcome flag_move(int x, int y)
+{
+	struct tile *t = &g_board[y][x];
+	enum outcome outcome = PLAYING;
+	if (t->revealed) return REFUSED;
+	toggle_flag(x, y);
+	add_change(x, y, 1);
+	if (g_n_found == g_n_mines && g_n_flags == g_n_found) outcome = WON;
+	record_move(REPLAY_FLAG, x, y, outcome);
+	return outcome;
+}
+
+/* Defined after the solver it uses, which itself reveals tiles. */
+static int make_solvable(int x, int y);
+
+/** Fit the hidden board with its mines placed to a first reveal at (x, y), so
+  * that (x, y) is safe, with GEN_OPENING such that the tiles around it are
+  * too, and with GEN_NOGUESS such that the rest follows from it. 1 is
+  * returned if the board was made solvable where asked and, if range is not
+  * NULL, has stats within range, which are then in *st. Otherwise 0 is
+  * returned. Boards out of range are turned down before the slow work of
+  * GEN_NOGUESS, most of them partway through board_stats(). */
+static int fit_board(int x, int y, const struct stats_range *range,
+	struct board_stats *st)
+{
+	if (g_gen & GEN_OPENING) {
+		make_opening(x, y);
+	} else {
+		make_space(x, y);
+	}
+	if (range && board_stats(st, range)) return 0;
+	if (g_gen & GEN_NOGUESS) {
+		if (!make_solvable(x, y)) return 0;
+		/* Moving mines to make it solvable may have changed the
+		 * stats. */
+		if (range && board_stats(st, range)) return 0;
+	}
+	return 1;
+}
+
+/** Generate the board for a first reveal at (x, y) with fit_board(). With
+  * GEN_RANGE, boards are drawn until one fits g_range, each carrying on from
+  * the seed where the last left off so that a seed always gives the same
+  * board. Only the mines are redrawn, as the board is still hidden. After
+  * RANGE_MAX_TRIES boards, the last is kept. Flags placed before are lifted
+  * while the board is made, so that the solver does not trust them, and then
+  * put back. */
+static void generate(int x, int y)
+{
+	static char flagged[MAX_TILES];
+	struct board_stats st;
+	long tries;
+	int i, n_tiles = g_width * g_height;
+	for (i = 0; i < n_tiles; ++i) {
+		flagged[i] = g_board[i / g_width][i % g_width].flagged;
+		g_board[i / g_width][i % g_width].flagged = 0;
+	}
+	g_n_flags = 0;
+	init_board();
+	for (tries = 1;; ++tries) {
+		const struct stats_range *range = NULL;
+		if (g_gen & GEN_RANGE && tries < RANGE_MAX_TRIES)
+			range = &g_range;
+		if (fit_board(x, y, range, &st) || !range) break;
+		clear_mines();
+		place_mines();
+	}
+	g_n_flags = g_n_found = 0;
+	for (i = 0; i < n_tiles; ++i) {
+		struct tile *t = &g_board[i / g_width][i % g_width];
+		t->flagged = flagged[i];
+		g_n_flags += t->flagged;
+		g_n_found += t->flagged & t->mine;
+	}
+	recount_around();
+}
+
+/** Reveal (x, y). On the first move, the board is generated by generate().
+  * Flagged tiles cannot be revealed. */
+static enum outcome reveal_move(int x, int y)
+{
+	enum outcome outcome;
+	if (g_board[y][x].flagged) return REFUSED;
+	if (!g_board_initialized) generate(x, y);
+	outcome = reveal(x, y) ? PLAYING : LOST;
+	record_move(REPLAY_REVEAL, x, y, outcome);
+	return outcome;
+}
+
+/** Get the flagged tiles and the tiles neither flagged nor revealed around
+  * (x, y) into *flags and *unknown. */
+static void count_around(int x, int y, int *flags, int *unknown)
+{
+	*flags = g_board[y][x].flags_around;
+	*unknown = g_board[y][x].unknown_around;
+}
+
+/** Chord at (x, y): if it is a number with as many flags around it as mines,
+  * reveal all its other hidden neighbours. If cascade is nonzero, every number
+  * those reveals leave with all its flags is chorded in turn until none is
+  * left. Flags are trusted, so a wrong flag can lead to a mine. REFUSED is
+  * returned if (x, y) cannot be chorded, and otherwise the outcome of the
+  * last reveal. */
+static enum outcome chord_move(int x, int y, int cascade)
+{
+	enum outcome outcome = PLAYING;
+	struct tile *t = &g_board[y][x];
+	if (!t->revealed || t->mine || t->flags_around != t->around
+	 || t->unknown_around == 0)
+		return REFUSED;
+	g_in_work[y][x] = 1;
+	g_work[g_n_work++] = y * g_width + x;
+	g_solving = cascade;
+	while (g_n_work > 0 && outcome == PLAYING) {
+		int i = g_work[--g_n_work], angle;
+		x = i % g_width;
+		y = i / g_width;
+		t = &g_board[y][x];
+		g_in_work[y][x] = 0;
+		if (t->flags_around != t->around) continue;
+		for (angle = 0; angle < 8 && outcome == PLAYING; ++angle) {
+			int ax = x + cosine(angle);
+			int ay = y + sine(angle);
+			if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height
+			 || g_board[ay][ax].revealed
+			 || g_board[ay][ax].flagged)
+				continue;
+			outcome = reveal_move(ax, ay);
+		}
+	}
+	g_solving = 0;
+	while (g_n_work > 0) {
+		int i = g_work[--g_n_work];
+		g_in_work[i / g_width][i % g_width] = 0;
+	}
+	return outcome;
+}
+
+/** Count the bits set in the number. */
+static int count_bits(unsigned long n)
+{
+	int bits = 0;
+	for (; n; n &= n - 1) {
+		++bits;
+	}
+	return bits;
+}
+
+/** Make every move that follows from single numbers on the visible board. If
+  * a number already has that many flags around it, its other hidden neighbours
+  * are revealed. If its hidden neighbours are exactly as many as the mines it
+  * lacks flags for, they are all flagged. Flags are trusted, so a wrong flag
+  * can lead to a mine. Only numbers near changed tiles are checked again, so
+  * after the first pass the work done follows the changes made. *n_moves is set
+  * to the number of reveals and flags made. The outcome of the last one is
+  * returned, or PLAYING if there were none. */
+static enum outcome solve_basic(int *n_moves)
+{
+	enum outcome outcome = PLAYING;
+	int x, y, i;
+	*n_moves = 0;
+	/* Only numbers next to the frontier can force anything. */
+	for (i = 0; i < g_n_frontier; ++i) {
+		queue_around(g_frontier[i] % g_width, g_frontier[i] / g_width);
+	}
+	g_solving = 1;
+	while (g_n_work > 0 && outcome == PLAYING) {
+		int flags, unknown, angle;
+		i = g_work[--g_n_work];
+		x = i % g_width;
+		y = i / g_width;
+		g_in_work[y][x] = 0;
+		count_around(x, y, &flags, &unknown);
+		if (unknown == 0) continue;
+		if (flags != g_board[y][x].around
+		 && flags + unknown != g_board[y][x].around) continue;
+		for (angle = 0; angle < 8 && outcome == PLAYING; ++angle) {
+			int ax = x + cosine(angle);
+			int ay = y + sine(angle);
+			struct tile *t;
+			if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height)
+				continue;
+			t = &g_board[ay][ax];
+			if (t->revealed || t->flagged) continue;
+			if (flags == g_board[y][x].around) {
+				outcome = reveal_move(ax, ay);
+			} else {
+				outcome = flag_move(ax, ay);
+			}
+			++*n_moves;
+		}
+	}
+	g_solving = 0;
+	while (g_n_work > 0) {
+		int i = g_work[--g_n_work];
+		g_in_work[i / g_width][i % g_width] = 0;
+	}
+	return outcome;
+}
+
+/** Set up g_patterns by trying every arrangement of mines in every window. */
+static void init_patterns(void)
+{
+	static unsigned short all_safe[9][9], all_mine[9][9];
+	static char seen[9][9];
+	int mask, a, b;
+	for (mask = 0; mask < 1 << PATTERN_CELLS; ++mask) {
+		int sub = mask;
+		memset(seen, 0, sizeof(seen));
+		/* Go through each subset sub of mask as the mines. */
+		for (;;) {
+			a = count_bits(sub & PATTERN_FIRST);
+			b = count_bits(sub & PATTERN_SECOND);
+			if (!seen[a][b]) {
+				seen[a][b] = 1;
+				all_safe[a][b] = (unsigned short)(mask & ~sub);
+				all_mine[a][b] = (unsigned short)sub;
+			} else {
+				all_safe[a][b] &= (unsigned short)~sub;
+				all_mine[a][b] &= (unsigned short)sub;
+			}
+			if (sub == 0) break;
+			sub = (sub - 1) & mask;
+		}
+		for (a = 0; a < 9; ++a) {
+			for (b = 0; b < 9; ++b) {
+				g_patterns[mask][a][b].safe =
+					seen[a][b] ? all_safe[a][b] : 0;
+				g_patterns[mask][a][b].mine =
+					seen[a][b] ? all_mine[a][b] : 0;
+			}
+		}
+	}
+	g_patterns_ready = 1;
+}
+
+/** Order tile indices, for qsort(). */
+static int compare_tiles(const void *a, const void *b)
+{
+	int ta = *(const int *)a, tb = *(const int *)b;
+	return ta < tb ? -1 : ta > tb;
+}
+
+/** Put the tile index of each revealed number with hidden, unflagged tiles
+  * around it into numbers, in board order. They are found around g_frontier,
+  * so the rest of the board is not looked at. The number of them is
+  * returned. */
+static int frontier_numbers(int *numbers)
+{
+	static char seen[MAX_TILES];
+	int i, n = 0;
+	for (i = 0; i < g_n_frontier; ++i) {
+		int at = g_frontier[i], angle;
+		for (angle = 0; angle < 8; ++angle) {
+			int ax = at % g_width + cosine(angle);
+			int ay = at / g_width + sine(angle);
+			int a = ay * g_width + ax;
+			if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height
+			 || !g_board[ay][ax].revealed || g_board[ay][ax].mine
+			 || seen[a])
+				continue;
+			seen[a] = 1;
+			numbers[n++] = a;
+		}
+	}
+	for (i = 0; i < n; ++i) {
+		seen[numbers[i]] = 0;
+	}
+	qsort(numbers, n, sizeof(*numbers), compare_tiles);
+	return n;
+}
+
+/** Get the window mask of hidden tiles around the pair of numbers at (x, y)
+  * and the next tile along. planes is g_rows for a pair side by side, with
+  * (x, y) as given, or g_cols for a pair one above the other, with x and y
+  * swapped. n_planes is the number of planes. */
+static int pattern_window(const unsigned long *planes, int n_planes, int x,
+	int y)
+{
+	int r, window = 0;
+	for (r = 0; r < 3; ++r) {
+		if (y - 1 + r < 0 || y - 1 + r >= n_planes) continue;
+		window |= (int)((planes[y - 1 + r] << 1 >> x) & 0xF) << 4 * r;
+	}
+	/* Drop the bits of the numbers themselves. */
+	return (window & 0x1F) | (window >> 2 & 0x3E0);
+}
+
+/** Make every move that follows from a pair of side by side or stacked
+  * numbers, looked up in g_patterns rather than worked out. This covers the
+  * usual patterns like 1-1 and 1-2 against walls and corners, and so 1-2-1
+  * and 1-2-2-1 pair by pair. The window of a pair side by side is the three
+  * rows of four tiles around it with the numbers left out, numbered left to
+  * right and top to bottom; a stacked pair's window is the same turned on
+  * its side. Only the numbers around g_frontier are looked at. *n_moves and
+  * the outcome are as for solve_basic(). */
+static enum outcome solve_patterns(int *n_moves)
+{
+	static int numbers[MAX_TILES];
+	/* One more than the mines each number lacks flags for, or 0 for tiles
+	 * that are not numbers around the frontier. */
+	static int need[MAX_TILES];
+	enum outcome outcome = PLAYING;
+	int i, n_numbers, flags, unknown;
+	*n_moves = 0;
+	if (!g_patterns_ready) init_patterns();
+	n_numbers = frontier_numbers(numbers);
+	for (i = 0; i < n_numbers; ++i) {
+		struct tile *t = &g_board[numbers[i] / g_width]
+			[numbers[i] % g_width];
+		count_around(numbers[i] % g_width, numbers[i] / g_width,
+			&flags, &unknown);
+		if (flags <= t->around) need[numbers[i]] = t->around - flags + 1;
+	}
+	/* The numbers are out of date once a move is made. */
+	for (i = 0; i < n_numbers && *n_moves == 0; ++i) {
+		int x = numbers[i] % g_width, y = numbers[i] / g_width, down;
+		if (!need[numbers[i]]) continue;
+		for (down = 0; down <= 1 && *n_moves == 0; ++down) {
+			int bx = x + !down, by = y + down, window, cell;
+			int first = need[numbers[i]] - 1, second, safe, mine;
+			if (bx >= g_width || by >= g_height
+			 || !need[by * g_width + bx])
+				continue;
+			second = need[by * g_width + bx] - 1;
+			window = down
+				? pattern_window(g_cols, g_width, y, x)
+				: pattern_window(g_rows, g_height, x, y);
+			safe = g_patterns[window][first][second].safe;
+			mine = g_patterns[window][first][second].mine;
+			for (cell = 0; cell < PATTERN_CELLS && outcome == PLAYING;
+				++cell) {
+				int at = cell < 5 ? cell : cell + 2;
+				int c = at % 4 - 1, r = at / 4 - 1;
+				int tx = down ? x + r : x + c;
+				int ty = down ? y + c : y + r;
+				if (!((safe | mine) >> cell & 1)
+				 || g_board[ty][tx].revealed
+				 || g_board[ty][tx].flagged)
+					continue;
+				outcome = safe >> cell & 1
+					? reveal_move(tx, ty)
+					: flag_move(tx, ty);
+				++*n_moves;
+			}
+		}
+	}
+	for (i = 0; i < n_numbers; ++i) {
+		need[numbers[i]] = 0;
+	}
+	return outcome;
+}
+
+/** Set up g_var_tile and the other frontier globals from the visible board.
+  * Variables are numbered breadth-first through the constraints so that each
+  * independent component is a contiguous run, and so that enumerating a run
+  * in order completes constraints early. */
+static void build_frontier(void)
+{
+	/* One more than the constraint of each tile, or 0 for none. */
+	static int con_of_tile[MAX_TILES], numbers[MAX_TILES];
+	int i, n_numbers;
+	/* Only the tiles of the last build have variables to forget. */
+	for (i = 0; i < g_n_vars; ++i) {
+		g_tile_var[g_var_tile[i]] = -1;
+	}
+	g_n_vars = g_n_cons = g_n_comps = g_n_interior = 0;
+	/* Make a constraint of each number with hidden neighbours. */
+	n_numbers = frontier_numbers(numbers);
+	for (i = 0; i < n_numbers; ++i) {
+		int x = numbers[i] % g_width, y = numbers[i] / g_width;
+		struct tile *t = &g_board[y][x];
+		struct constraint *c = &g_cons[g_n_cons];
+		int angle, flags, unknown;
+		count_around(x, y, &flags, &unknown);
+		c->need = t->around - flags;
+		c->n_vars = 0;
+		for (angle = 0; angle < 8; ++angle) {
+			int ax = x + cosine(angle);
+			int ay = y + sine(angle);
+			if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height
+			 || g_board[ay][ax].revealed
+			 || g_board[ay][ax].flagged)
+				continue;
+			c->vars[c->n_vars++] = ay * g_width + ax;
+		}
+		con_of_tile[numbers[i]] = ++g_n_cons;
+	}
+	/* Number the variables breadth-first. g_var_tile doubles as the
+	 * queue. Constraints hold tile indices until they are renumbered. */
+	for (i = 0; i < g_n_cons; ++i) {
+		int head = g_n_vars, j;
+		if (g_tile_var[g_cons[i].vars[0]] >= 0) continue;
+		g_comp_start[g_n_comps++] = g_n_vars;
+		g_tile_var[g_cons[i].vars[0]] = g_n_vars;
+		g_var_tile[g_n_vars++] = g_cons[i].vars[0];
+		for (; head < g_n_vars; ++head) {
+			int at = g_var_tile[head], angle;
+			g_var_n_cons[head] = 0;
+			for (angle = 0; angle < 8; ++angle) {
+				int ax = at % g_width + cosine(angle);
+				int ay = at / g_width + sine(angle);
+				int con;
+				struct constraint *c;
+				if (ax < 0 || ax >= g_width
+				 || ay < 0 || ay >= g_height)
+					continue;
+				con = con_of_tile[ay * g_width + ax] - 1;
+				if (con < 0) continue;
+				g_var_cons[head][g_var_n_cons[head]++] = con;
+				c = &g_cons[con];
+				for (j = 0; j < c->n_vars; ++j) {
+					if (g_tile_var[c->vars[j]] >= 0)
+						continue;
+					g_tile_var[c->vars[j]] = g_n_vars;
+					g_var_tile[g_n_vars++] = c->vars[j];
+				}
+			}
+		}
+	}
+	g_comp_start[g_n_comps] = g_n_vars;
+	for (i = 0; i < g_n_cons; ++i) {
+		int j;
+		for (j = 0; j < g_cons[i].n_vars; ++j) {
+			g_cons[i].vars[j] = g_tile_var[g_cons[i].vars[j]];
+		}
+	}
+	for (i = 0; i < n_numbers; ++i) {
+		con_of_tile[numbers[i]] = 0;
+	}
+	g_n_interior = g_n_unknown - g_n_vars;
+}
+
+/** Set row a to a - b if sub is nonzero, or to a + b otherwise, over the first
+  * n_words words. Coefficients must stay within -1 and 1, so nothing is done
+  * and -1 returned if any would not. 0 is returned on success. */
+static int combine_rows(struct row *a, const struct row *b, int sub,
+	int n_words)
+{
+	const unsigned long *b_pos = sub ? b->pos : b->neg;
+	const unsigned long *b_neg = sub ? b->neg : b->pos;
+	int i;
+	for (i = 0; i < n_words; ++i) {
+		if ((a->pos[i] & b_neg[i]) || (a->neg[i] & b_pos[i]))
+			return -1;
+	}
+	for (i = 0; i < n_words; ++i) {
+		unsigned long pos = (a->pos[i] & ~b_pos[i]) | (b_neg[i] & ~a->neg[i]);
+		a->neg[i] = (a->neg[i] & ~b_neg[i]) | (b_pos[i] & ~a->pos[i]);
+		a->pos[i] = pos;
+	}
+	a->sum += sub ? -b->sum : b->sum;
+	return 0;
+}
+
+/** Find the frontier tiles forced by linear combinations of the numbers, and
+  * reveal or flag them. Each number is a row saying its hidden neighbours sum
+  * to the mines it lacks flags for. If the frontier is all that is hidden, the
+  * remaining mine count is a row too. The rows are reduced by elimination over
+  * bit sets, skipping reductions that would leave a coefficient outside -1 to
+  * 1. A row whose sum is the most or the least its variables could give forces
+  * them all. Forced variables are put back into the rows until no more are
+  * found. *n_moves and the outcome are as for solve_basic(). */
+static enum outcome solve_linear(int *n_moves)
+{
+	static struct row rows[MAX_TILES + 1];
+	/* The variables found, and which of those are mines. */
+	unsigned long known[SET_WORDS], mines[SET_WORDS];
+	enum outcome outcome = PLAYING;
+	int n_rows, n_words, rank, i, j, v, found;
+	*n_moves = 0;
+	build_frontier();
+	if (g_n_vars == 0) return PLAYING;
+	n_words = (g_n_vars + LONG_BITS - 1) / LONG_BITS;
+	n_rows = g_n_cons + (g_n_interior == 0);
+	for (i = 0; i < n_rows; ++i) {
+		memset(&rows[i], 0, sizeof(rows[i]));
+		if (i == g_n_cons) {
+			for (v = 0; v < g_n_vars; ++v) {
+				rows[i].pos[v / LONG_BITS] |= 1UL << v % LONG_BITS;
+			}
+			rows[i].sum = g_n_mines - g_n_flags;
+			continue;
+		}
+		for (j = 0; j < g_cons[i].n_vars; ++j) {
+			v = g_cons[i].vars[j];
+			rows[i].pos[v / LONG_BITS] |= 1UL << v % LONG_BITS;
+		}
+		rows[i].sum = g_cons[i].need;
+	}
+	/* Eliminate each variable in turn from every row but one. */
+	rank = 0;
+	for (v = 0; v < g_n_vars && rank < n_rows; ++v) {
+		int word = v / LONG_BITS;
+		unsigned long bit = 1UL << v % LONG_BITS;
+		for (i = rank; i < n_rows; ++i) {
+			if ((rows[i].pos[word] | rows[i].neg[word]) & bit) break;
+		}
+		if (i == n_rows) continue;
+		if (i != rank) {
+			struct row swap = rows[i];
+			rows[i] = rows[rank];
+			rows[rank] = swap;
+		}
+		for (i = 0; i < n_rows; ++i) {
+			if (i == rank) continue;
+			if (rows[i].pos[word] & bit) {
+				combine_rows(&rows[i], &rows[rank],
+					!(rows[rank].neg[word] & bit), n_words);
+			} else if (rows[i].neg[word] & bit) {
+				combine_rows(&rows[i], &rows[rank],
+					!!(rows[rank].neg[word] & bit), n_words);
+			}
+		}
+		++rank;
+	}
+	/* Bound each row, putting what is found back into all of them. */
+	memset(known, 0, sizeof(known));
+	memset(mines, 0, sizeof(mines));
+	do {
+		found = 0;
+		for (i = 0; i < n_rows; ++i) {
+			int n_pos = 0, n_neg = 0;
+			for (j = 0; j < n_words; ++j) {
+				n_pos += count_bits(rows[i].pos[j]);
+				n_neg += count_bits(rows[i].neg[j]);
+			}
+			if (n_pos + n_neg == 0
+			 || (rows[i].sum != n_pos && rows[i].sum != -n_neg))
+				continue;
+			for (j = 0; j < n_words; ++j) {
+				known[j] |= rows[i].pos[j] | rows[i].neg[j];
+				mines[j] |= rows[i].sum == n_pos
+					? rows[i].pos[j] : rows[i].neg[j];
+			}
+			found = 1;
+		}
+		for (i = 0; i < n_rows && found; ++i) {
+			for (j = 0; j < n_words; ++j) {
+				rows[i].sum -= count_bits(rows[i].pos[j] & mines[j])
+					- count_bits(rows[i].neg[j] & mines[j]);
+				rows[i].pos[j] &= ~known[j];
+				rows[i].neg[j] &= ~known[j];
+			}
+		}
+	} while (found);
+	for (v = 0; v < g_n_vars && outcome == PLAYING; ++v) {
+		int x = g_var_tile[v] % g_width, y = g_var_tile[v] / g_width;
+		unsigned long bit = 1UL << v % LONG_BITS;
+		if (!(known[v / LONG_BITS] & bit)) continue;
+		outcome = mines[v / LONG_BITS] & bit
+			? flag_move(x, y) : reveal_move(x, y);
+		++*n_moves;
+	}
+	return outcome;
+}
+
+/** A list of the clauses watching a literal in g_sat. */
+struct watch_list {
+	int *refs;
+	int n, cap;
+};
+
+/** The state of the SAT solver used by solve_sat(). Variable v has literals
+  * 2 * v, which is true when v is, and 2 * v + 1. Tile i is variable i, and is
+  * true if it has a mine; the variables after the tiles count mines for the
+  * numbers' constraints. Only revealed tiles are encoded, not flags, so the
+  * clauses and everything learned from them stay true as more is revealed. */
+static struct {
+	/* Whether each tile's facts have been added, and whether it is in any
+	 * clause. */
+	char added[MAX_TILES], used[MAX_TILES];
+	/* The tiles in clauses, which are the ones decided on. */
+	int decide[MAX_TILES], n_decide;
+	/* Whether the clauses cannot all be satisfied. */
+	int failed;
+	/* The number of variables and the space for them. */
+	int n_vars, vars_cap;
+	/* Per variable: 1 if true, 0 if false and -1 if unassigned; the last
+	 * value it had; the decision level it was assigned at; the offset of
+	 * the clause that implied it, or -1; whether analyze_conflict() has
+	 * seen it; and how often it has been in recent conflicts. */
+	signed char *value, *phase;
+	int *level, *reason;
+	char *seen;
+	double *activity;
+	/* Each clause is its length followed by its literals. The literal it
+	 * implied is first, and the two watched literals are first. */
+	int *clauses, n_clause_ints, clauses_cap;
+	/* The clauses watching each literal. */
+	struct watch_list *watches;
+	int watches_cap;
+	/* The literals assigned, in order, and the next to propagate. */
+	int *trail, n_trail, trail_cap, head;
+	/* Where each decision level starts in trail. */
+	int *levels, n_levels, levels_cap;
+	/* The amount added to activity for being in a conflict. */
+	double bump;
+	/* The number of conflicts seen and the number at the next restart. */
+	long n_conflicts, restart_at;
+} g_sat;
+
+/** The value of the literal in g_sat: 1 if true, 0 if false, -1 if
+  * unassigned. */
+#define SAT_VALUE(lit) (g_sat.value[(lit) >> 1] < 0 ? -1 \
+	: g_sat.value[(lit) >> 1] ^ ((lit) & 1))
+
+/** Throw away every clause and variable in g_sat. */
+static void sat_reset(void)
+{
+	int i;
+	for (i = 0; i < 2 * g_sat.n_vars; ++i) {
+		free(g_sat.watches[i].refs);
+	}
+	free(g_sat.value);
+	free(g_sat.phase);
+	free(g_sat.level);
+	free(g_sat.reason);
+	free(g_sat.seen);
+	free(g_sat.activity);
+	free(g_sat.clauses);
+	free(g_sat.watches);
+	free(g_sat.trail);
+	free(g_sat.levels);
+	memset(&g_sat, 0, sizeof(g_sat));
+	g_sat.bump = 1;
+	g_sat.restart_at = SAT_RESTART;
+}
+
+/** Add a variable to g_sat and return it. */
+static int sat_new_var(void)
+{
+	int v = g_sat.n_vars++, cap = g_sat.vars_cap;
+	g_sat.value = grow(g_sat.value, &cap, g_sat.n_vars, 1);
+	cap = g_sat.vars_cap;
+	g_sat.phase = grow(g_sat.phase, &cap, g_sat.n_vars, 1);
+	cap = g_sat.vars_cap;
+	g_sat.seen = grow(g_sat.seen, &cap, g_sat.n_vars, 1);
+	cap = g_sat.vars_cap;
+	g_sat.level = grow(g_sat.level, &cap, g_sat.n_vars, sizeof(int));
+	cap = g_sat.vars_cap;
+	g_sat.reason = grow(g_sat.reason, &cap, g_sat.n_vars, sizeof(int));
+	cap = g_sat.vars_cap;
+	g_sat.activity = grow(g_sat.activity, &cap, g_sat.n_vars,
+		sizeof(double));
+	g_sat.vars_cap = cap;
+	cap = g_sat.watches_cap;
+	g_sat.watches = grow(g_sat.watches, &g_sat.watches_cap,
+		2 * g_sat.n_vars, sizeof(struct watch_list));
+	memset(g_sat.watches + cap, 0,
+		(g_sat.watches_cap - cap) * sizeof(struct watch_list));
+	g_sat.trail = grow(g_sat.trail, &g_sat.trail_cap, g_sat.n_vars,
+		sizeof(int));
+	g_sat.levels = grow(g_sat.levels, &g_sat.levels_cap, g_sat.n_vars + 1,
+		sizeof(int));
+	g_sat.value[v] = -1;
+	g_sat.phase[v] = 0;
+	g_sat.seen[v] = 0;
+	g_sat.activity[v] = 0;
+	return v;
+}
+
+/** Make lit true at the current decision level. reason is as for
+  * g_sat.reason. */
+static void sat_assign(int lit, int reason)
+{
+	int v = lit >> 1;
+	g_sat.value[v] = !(lit & 1);
+	g_sat.level[v] = g_sat.n_levels;
+	g_sat.reason[v] = reason;
+	g_sat.trail[g_sat.n_trail++] = lit;
+}
+
+/** Make the clause at offset ref watch the literal. */
+static void sat_watch(int lit, int ref)
+{
+	struct watch_list *w = &g_sat.watches[lit];
+	w->refs = grow(w->refs, &w->cap, w->n + 1, sizeof(int));
+	w->refs[w->n++] = ref;
+}
+
+/** Store a clause of n literals, watching its first two, and return its
+  * offset. */
+static int sat_store(const int *lits, int n)
+{
+	int ref = g_sat.n_clause_ints;
+	g_sat.n_clause_ints += n + 1;
+	g_sat.clauses = grow(g_sat.clauses, &g_sat.clauses_cap,
+		g_sat.n_clause_ints, sizeof(int));
+	g_sat.clauses[ref] = n;
+	memcpy(g_sat.clauses + ref + 1, lits, n * sizeof(int));
+	sat_watch(lits[0], ref);
+	sat_watch(lits[1], ref);
+	return ref;
+}
+
+/** Propagate the assignments not yet propagated. The offset of a clause made
+  * false is returned, or -1 if none was. */
+static int sat_propagate(void)
+{
+	while (g_sat.head < g_sat.n_trail) {
+		int lit = g_sat.trail[g_sat.head++] ^ 1;
+		struct watch_list *w = &g_sat.watches[lit];
+		int i, j;
+		for (i = j = 0; i < w->n; ++i) {
+			int ref = w->refs[i], k, n = g_sat.clauses[ref];
+			int *c = g_sat.clauses + ref + 1;
+			if (c[0] == lit) {
+				c[0] = c[1];
+				c[1] = lit;
+			}
+			if (SAT_VALUE(c[0]) == 1) {
+				w->refs[j++] = ref;
+				continue;
+			}
+			for (k = 2; k < n && SAT_VALUE(c[k]) == 0; ++k)
+				;
+			if (k < n) {
+				c[1] = c[k];
+				c[k] = lit;
+				sat_watch(c[1], ref);
+				continue;
+			}
+			w->refs[j++] = ref;
+			if (SAT_VALUE(c[0]) == 0) {
+				while (++i < w->n) {
+					w->refs[j++] = w->refs[i];
+				}
+				w->n = j;
+				g_sat.head = g_sat.n_trail;
+				return ref;
+			}
+			sat_assign(c[0], ref);
+		}
+		w->n = j;
+	}
+	return -1;
+}
+
+/** Undo every assignment above the decision level. */
+static void sat_backtrack(int level)
+{
+	if (g_sat.n_levels <= level) return;
+	while (g_sat.n_trail > g_sat.levels[level]) {
+		int v = g_sat.trail[--g_sat.n_trail] >> 1;
+		g_sat.phase[v] = g_sat.value[v];
+		g_sat.value[v] = -1;
+	}
+	g_sat.n_levels = level;
+	g_sat.head = g_sat.n_trail;
+}
+
+/** Make the variable more likely to be decided on next. */
+static void sat_bump(int v)
+{
+	if ((g_sat.activity[v] += g_sat.bump) > 1e100) {
+		int i;
+		for (i = 0; i < g_sat.n_vars; ++i) {
+			g_sat.activity[i] *= 1e-100;
+		}
+		g_sat.bump *= 1e-100;
+	}
+}
+
+/** Learn a clause from the conflict in the clause at offset ref. Its literals
+  * are put in learned, which must have room for one per variable, with the
+  * one it implies first, and their number is returned. The clause is the first
+  * cut through the implication graph with just one literal from the current
+  * decision level. *back is set to the level to go back to, where the clause
+  * will imply its first literal. */
+static int sat_analyze(int ref, int *learned, int *back)
+{
+	int n = 1, open = 0, lit = -1, at = g_sat.n_trail - 1, i;
+	do {
+		int len = g_sat.clauses[ref];
+		const int *c = g_sat.clauses + ref + 1;
+		for (i = lit < 0 ? 0 : 1; i < len; ++i) {
+			int v = c[i] >> 1;
+			if (g_sat.seen[v] || g_sat.level[v] == 0) continue;
+			g_sat.seen[v] = 1;
+			sat_bump(v);
+			if (g_sat.level[v] >= g_sat.n_levels) {
+				++open;
+			} else {
+				learned[n++] = c[i];
+			}
+		}
+		while (!g_sat.seen[g_sat.trail[at] >> 1]) {
+			--at;
+		}
+		lit = g_sat.trail[at--];
+		ref = g_sat.reason[lit >> 1];
+		g_sat.seen[lit >> 1] = 0;
+	} while (--open > 0);
+	learned[0] = lit ^ 1;
+	*back = 0;
+	for (i = 1; i < n; ++i) {
+		int v = learned[i] >> 1;
+		g_sat.seen[v] = 0;
+		if (g_sat.level[v] > *back) {
+			int swap = learned[1];
+			*back = g_sat.level[v];
+			learned[1] = learned[i];
+			learned[i] = swap;
+		}
+	}
+	g_sat.bump /= 0.95;
+	return n;
+}
+
+/** Add a clause of n literals to g_sat, which must be at decision level 0.
+  * The literals may be reordered. */
+static void sat_add_clause(int *lits, int n)
+{
+	int i, j;
+	if (g_sat.failed) return;
+	for (i = j = 0; i < n; ++i) {
+		int val = SAT_VALUE(lits[i]);
+		if (val == 1) return;
+		if (val < 0) lits[j++] = lits[i];
+	}
+	if (j == 0) {
+		g_sat.failed = 1;
+	} else if (j == 1) {
+		sat_assign(lits[0], -1);
+		if (sat_propagate() >= 0) g_sat.failed = 1;
+	} else {
+		sat_store(lits, j);
+	}
+}
+
+/** Add clauses saying at most k of the n literals are true, using a sequential
+  * counter: the kth variable at step i says that at least k of the literals up
+  * to i are true. */
+static void sat_at_most(const int *lits, int n, int k)
+{
+	int i, j, prev = 0, next, c[3];
+	if (k >= n) return;
+	if (k == 0) {
+		for (i = 0; i < n; ++i) {
+			c[0] = lits[i] ^ 1;
+			sat_add_clause(c, 1);
+		}
+		return;
+	}
+	/* The counter for step i is variables next + 0 to next + k - 1. */
+	for (i = 0; i < n; ++i) {
+		next = g_sat.n_vars;
+		if (i < n - 1) {
+			for (j = 0; j < k; ++j) {
+				sat_new_var();
+			}
+			c[0] = lits[i] ^ 1;
+			c[1] = 2 * next;
+			sat_add_clause(c, 2);
+		}
+		if (i == 0) {
+			for (j = 1; j < k; ++j) {
+				c[0] = 2 * (next + j) + 1;
+				sat_add_clause(c, 1);
+			}
+		} else {
+			c[0] = lits[i] ^ 1;
+			c[1] = 2 * (prev + k - 1) + 1;
+			sat_add_clause(c, 2);
+			if (i == n - 1) break;
+			for (j = 0; j < k; ++j) {
+				c[0] = 2 * (prev + j) + 1;
+				c[1] = 2 * (next + j);
+				sat_add_clause(c, 2);
+				if (j == 0) continue;
+				c[0] = lits[i] ^ 1;
+				c[1] = 2 * (prev + j - 1) + 1;
+				c[2] = 2 * (next + j);
+				sat_add_clause(c, 3);
+			}
+		}
+		prev = next;
+	}
+}
+
+/** Add the facts shown by the revealed tiles not yet added to g_sat: each
+  * revealed tile is safe, and exactly its number of the tiles around it are
+  * mines. If a tile added before has been hidden again by undoing, everything
+  * is thrown away and added again. */
+static void sat_sync(void)
+{
+	int i, n_tiles = g_width * g_height;
+	for (i = 0; i < n_tiles; ++i) {
+		if (g_sat.added[i] && !g_board[i / g_width][i % g_width].revealed)
+			break;
+	}
+	if (i < n_tiles || g_sat.n_vars == 0) {
+		sat_reset();
+		for (i = 0; i < n_tiles; ++i) {
+			sat_new_var();
+		}
+	}
+	for (i = 0; i < n_tiles; ++i) {
+		int x = i % g_width, y = i / g_width, lits[8], n = 0, angle;
+		struct tile *t = &g_board[y][x];
+		if (g_sat.added[i] || !t->revealed || t->mine) continue;
+		g_sat.added[i] = 1;
+		lits[0] = 2 * i + 1;
+		sat_add_clause(lits, 1);
+		for (angle = 0; angle < 8; ++angle) {
+			int ax = x + cosine(angle);
+			int ay = y + sine(angle);
+			int at = ay * g_width + ax;
+			if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height)
+				continue;
+			lits[n++] = 2 * at;
+			if (!g_sat.used[at]) {
+				g_sat.used[at] = 1;
+				g_sat.decide[g_sat.n_decide++] = at;
+			}
+		}
+		sat_at_most(lits, n, t->around);
+		for (angle = 0; angle < n; ++angle) {
+			lits[angle] ^= 1;
+		}
+		sat_at_most(lits, n, n - t->around);
+	}
+}
+
+/** Decide whether the clauses in g_sat can be satisfied with the n_assume
+  * literals in assume all true. Each is put at its own decision level.
+  * Conflicts are analysed back to the first point where only one literal of
+  * the current level is involved, and the clauses learned are kept for later
+  * calls. Decisions are made on tile variables only, by activity and then the
+  * last value each had. Once those are all assigned, any counter variables
+  * left can be made false, since clauses only force them true by
+  * propagation. 1 is returned with the solution left assigned if one is
+  * found, and 0 otherwise. Call sat_backtrack(0) before anything else is
+  * added. */
+static int sat_solve(const int *assume, int n_assume)
+{
+	static int *learned = NULL;
+	static int learned_cap = 0;
+	if (g_sat.failed) return 0;
+	learned = grow(learned, &learned_cap, g_sat.n_vars, sizeof(int));
+	for (;;) {
+		int ref = sat_propagate(), n, back, i, best;
+		if (ref >= 0) {
+			if (g_sat.n_levels == 0) {
+				g_sat.failed = 1;
+				return 0;
+			}
+			n = sat_analyze(ref, learned, &back);
+			sat_backtrack(back);
+			sat_assign(learned[0], n > 1 ? sat_store(learned, n) : -1);
+			if (++g_sat.n_conflicts >= g_sat.restart_at) {
+				g_sat.restart_at += g_sat.restart_at / 2;
+				sat_backtrack(0);
+			}
+			continue;
+		}
+		if (g_sat.n_levels < n_assume) {
+			int lit = assume[g_sat.n_levels];
+			if (SAT_VALUE(lit) == 0) return 0;
+			g_sat.levels[g_sat.n_levels++] = g_sat.n_trail;
+			if (SAT_VALUE(lit) < 0) sat_assign(lit, -1);
+			continue;
+		}
+		best = -1;
+		for (i = 0; i < g_sat.n_decide; ++i) {
+			int v = g_sat.decide[i];
+			if (g_sat.value[v] < 0 && (best < 0
+			 || g_sat.activity[v] > g_sat.activity[best]))
+				best = v;
+		}
+		if (best < 0) return 1;
+		g_sat.levels[g_sat.n_levels++] = g_sat.n_trail;
+		sat_assign(2 * best + !g_sat.phase[best], -1);
+	}
+}
+
+/** Find the frontier tiles that every arrangement of mines consistent with
+  * the revealed numbers agrees on, and reveal or flag them. Each tile is
+  * checked by asking the SAT solver for an arrangement with it the other way,
+  * unless an arrangement found before already had it so. Flags are not
+  * trusted here, and the total mine count is not used. *n_moves and the
+  * outcome are as for solve_basic(). */
+static enum outcome solve_sat(int *n_moves)
+{
+	/* Per frontier variable: 1 for a mine and 2 for safe, if an
+	 * arrangement with that has been found, or'd together. */
+	static char witnessed[MAX_TILES];
+	static int forced[MAX_TILES];
+	enum outcome outcome = PLAYING;
+	int v, w, n_forced = 0;
+	*n_moves = 0;
+	sat_sync();
+	build_frontier();
+	memset(witnessed, 0, g_n_vars);
+	for (v = 0; v < g_n_vars && !g_sat.failed; ++v) {
+		int val;
+		for (val = 0; val <= 1; ++val) {
+			/* val = 0 tries a mine, and val = 1 tries safe. */
+			int lit = 2 * g_var_tile[v] + val;
+			if (witnessed[v] & (1 << val)) continue;
+			if (sat_solve(&lit, 1)) {
+				for (w = 0; w < g_n_vars; ++w) {
+					int at = g_var_tile[w];
+					witnessed[w] |= g_sat.value[at] ? 1 : 2;
+				}
+				sat_backtrack(0);
+			} else if (!g_sat.failed) {
+				sat_backtrack(0);
+				lit ^= 1;
+				sat_add_clause(&lit, 1);
+				forced[n_forced++] = lit;
+				break;
+			}
+		}
+	}
+	sat_backtrack(0);
+	for (v = 0; v < n_forced && outcome == PLAYING; ++v) {
+		int at = forced[v] >> 1;
+		outcome = forced[v] & 1
+			? reveal_move(at % g_width, at / g_width)
+			: flag_move(at % g_width, at / g_width);
+		++*n_moves;
+	}
+	return outcome;
+}
+
+/** Make every move that follows from the visible board by single numbers,
+  * then by pairs of them, then by linear combinations of them, then by
+  * search, until none finds more. Each is tried only when the ones before
+  * find nothing. *n_moves and the outcome are as for solve_basic(). */
+static enum outcome solve(int *n_moves)
+{
+	enum outcome outcome;
+	int n;
+	*n_moves = 0;
+	for (;;) {
+		outcome = solve_basic(&n);
+		*n_moves += n;
+		if (outcome != PLAYING) break;
+		if (n > 0) continue;
+		outcome = solve_patterns(&n);
+		*n_moves += n;
+		if (outcome != PLAYING) break;
+		if (n > 0) continue;
+		outcome = solve_linear(&n);
+		*n_moves += n;
+		if (outcome != PLAYING) break;
+		if (n > 0) continue;
+		outcome = solve_sat(&n);
+		*n_moves += n;
+		if (outcome != PLAYING || n == 0) break;
+	}
+	return outcome;
+}
+
+/** Whether tile i can have a mine moved from it by make_solvable() for a
+  * first reveal at (x, y), if mine is nonzero, or to it otherwise. A mine can
+  * be moved from a hidden tile, and to a tile without one that is not by
+  * (x, y). If near is positive, the tile must also be in or next to the
+  * frontier; if negative, it must be neither. */
+static int tile_fits(int i, int x, int y, int mine, int near)
+{
+	struct tile *t = &g_board[i / g_width][i % g_width];
+	int next_to = !t->revealed && t->numbers_around > 0, angle;
+	if (mine ? !t->mine || t->revealed || t->flagged
+	 : t->mine || (abs(i % g_width - x) <= 1 && abs(i / g_width - y) <= 1))
+		return 0;
+	for (angle = 0; angle < 8 && near && !next_to; ++angle) {
+		int ax = i % g_width + cosine(angle);
+		int ay = i / g_width + sine(angle);
+		next_to = ax >= 0 && ax < g_width && ay >= 0 && ay < g_height
+			&& g_frontier_at[ay * g_width + ax] >= 0;
+	}
+	return near > 0 ? next_to : near < 0 ? !next_to : 1;
+}
+
+/** Pick a random tile for which tile_fits() is true, as an index
+  * y * g_width + x, or return -1 if there is none. */
+static int pick_tile(int x, int y, int mine, int near)
+{
+	int i, n = 0, n_tiles = g_width * g_height;
+	for (i = 0; i < n_tiles; ++i) {
+		n += tile_fits(i, x, y, mine, near);
+	}
+	if (n == 0) return -1;
+	n = random_below(n);
+	for (i = 0; ; ++i) {
+		if (tile_fits(i, x, y, mine, near) && n-- == 0) return i;
+	}
+}
+
+/** Change the board made for a first reveal at (x, y) until solve() can
+  * clear it from there without guessing. Each try plays the board out with
+  * nothing recorded. If the solver gets stuck, a mine at or next to where it
+  * stopped is moved away from there, and the board is tried again. Only
+  * NOGUESS_MAX_MOVES mines are moved, so a board too dense to fix is kept as
+  * it is. The draws come from g_seed, so the same seed and first reveal
+  * always give the same board. Returned is whether the board can be solved. */
+static int make_solvable(int x, int y)
+{
+	FILE *record = g_record;
+	int keep_changes = g_keep_changes, n_moved, n, solved = 0;
+	g_record = NULL;
+	g_keep_changes = 0;
+	for (n_moved = 0; ; ++n_moved) {
+		int from = -1, to = -1, i, n_tiles = g_width * g_height;
+		/* The clauses from the last try describe the mines before one
+		 * was moved, and sat_sync() cannot tell. */
+		sat_reset();
+		reveal(x, y);
+		solved = solve(&n) == WON || g_n_unknown <= g_n_mines - g_n_flags;
+		if (!solved && n_moved < NOGUESS_MAX_MOVES) {
+			from = pick_tile(x, y, 1, 1);
+			if (from < 0) from = pick_tile(x, y, 1, 0);
+			to = pick_tile(x, y, 0, -1);
+			if (to < 0) to = pick_tile(x, y, 0, 0);
+		}
+		/* Hide everything again. */
+		for (i = 0; i < n_tiles; ++i) {
+			g_board[i / g_width][i % g_width].revealed = 0;
+			g_board[i / g_width][i % g_width].flagged = 0;
+		}
+		g_n_flags = g_n_found = 0;
+		recount_around();
+		if (from < 0 || to < 0) break;
+		g_board[from / g_width][from % g_width].mine = 0;
+		add_around(from % g_width, from / g_width, -1);
+		--g_row_mines[from / g_width];
+		g_board[to / g_width][to % g_width].mine = 1;
+		add_around(to % g_width, to / g_width, 1);
+		++g_row_mines[to / g_width];
+	}
+	g_record = record;
+	g_keep_changes = keep_changes;
+	return solved;
+}
+
+/** The state of enumerate() and count_vars(). */
+static struct {
+	/* The variables being enumerated and the number of them. */
+	const int *vars;
+	int n;
+	/* The number of mines placed so far. */
+	int mines;
+	/* The value of each variable, by position in vars. */
+	char value[MAX_TILES];
+	/* Per constraint: the mines it needs from the variables not fixed by
+	 * count_vars(), the mines placed, and the variables unassigned. */
+	int need[MAX_TILES], con_sum[MAX_TILES], con_left[MAX_TILES];
+	/* Per variable: whether count_vars() has fixed it, whether it has been
+	 * put in a piece, and its position in the set being split. */
+	char fixed[MAX_TILES], in_piece[MAX_TILES];
+	int pos[MAX_TILES];
+	/* Where to add solutions, as described for count_vars(). */
+	double *counts, *tile_counts;
+	int stride, shift;
+	/* The number of steps taken so far. */
+	long steps;
+} g_enum;
+
+/** Try both values for variable i of the set being enumerated, and all the
+  * values of the ones after it, counting every consistent assignment.
+  * Nothing more is done once ENUM_MAX_STEPS steps have been taken. */
+static void enumerate(int i)
+{
+	int val;
+	if (++g_enum.steps > ENUM_MAX_STEPS) return;
+	if (i == g_enum.n) {
+		int j, at = g_enum.mines + g_enum.shift;
+		g_enum.counts[at] += 1;
+		for (j = 0; j < g_enum.n; ++j) {
+			if (g_enum.value[j])
+				g_enum.tile_counts[j * g_enum.stride + at] += 1;
+		}
+		return;
+	}
+	for (val = 0; val <= 1; ++val) {
+		int v = g_enum.vars[i], j, ok = 1;
+		for (j = 0; j < g_var_n_cons[v]; ++j) {
+			int c = g_var_cons[v][j];
+			g_enum.con_sum[c] += val;
+			--g_enum.con_left[c];
+			if (g_enum.con_sum[c] > g_enum.need[c]
+			 || g_enum.con_sum[c] + g_enum.con_left[c]
+			  < g_enum.need[c])
+				ok = 0;
+		}
+		if (ok) {
+			g_enum.value[i] = (char)val;
+			g_enum.mines += val;
+			enumerate(i + 1);
+			g_enum.mines -= val;
+		}
+		for (j = 0; j < g_var_n_cons[v]; ++j) {
+			int c = g_var_cons[v][j];
+			g_enum.con_sum[c] -= val;
+			++g_enum.con_left[c];
+		}
+	}
+}
+
+/** Set out[0..a_len+b_len-2] to the convolution of a and b. */
+static void convolve(const double *a, int a_len, const double *b, int b_len,
+	double *out)
+{
+	int i, j;
+	for (i = 0; i < a_len + b_len - 1; ++i) {
+		out[i] = 0;
+	}
+	for (i = 0; i < a_len; ++i) {
+		if (a[i] == 0) continue;
+		for (j = 0; j < b_len; ++j) {
+			out[i + j] += a[i] * b[j];
+		}
+	}
+}
+
+/** Allocate n doubles, all zero. */
+static double *zeros(int n)
+{
+	double *d = calloc(n + 1, sizeof(double));
+	if (!d) {
+		fputs("Out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	return d;
+}
+
+/** Add the solutions of the n variables in vars to the counts. The set must
+  * hold every unfixed variable of the constraints it touches. counts[k +
+  * shift] is increased by the number of solutions with k mines, and
+  * tile_counts[j * stride + k + shift] by the number of those in which
+  * vars[j] is a mine.
+  *
+  * Small sets, and sets depth splits down, are enumerated. Larger ones are
+  * split into two tasks by fixing their middle variable each way; the
+  * variables are in breadth-first order, so that is where a cut is most
+  * likely. Without it, the rest may fall apart into independent pieces,
+  * each counted on its own and combined by convolution, which can be
+  * exponentially cheaper than enumerating them together. The tasks and
+  * pieces are done in order, so the result does not depend on how the work
+  * is scheduled. -1 is returned if more than ENUM_MAX_STEPS steps are taken,
+  * and 0 otherwise. */
+static int count_vars(const int *vars, int n, int depth, double *counts,
+	double *tile_counts, int stride, int shift)
+{
+	int *order, *starts, n_pieces = 0, i, j, k, val, mid = n / 2;
+	int v = vars[mid];
+	if (n <= SPLIT_MIN_VARS || depth >= SPLIT_MAX_DEPTH) {
+		for (i = 0; i < n; ++i) {
+			for (j = 0; j < g_var_n_cons[vars[i]]; ++j) {
+				int c = g_var_cons[vars[i]][j];
+				g_enum.con_sum[c] = g_enum.con_left[c] = 0;
+			}
+		}
+		for (i = 0; i < n; ++i) {
+			for (j = 0; j < g_var_n_cons[vars[i]]; ++j) {
+				++g_enum.con_left[g_var_cons[vars[i]][j]];
+			}
+		}
+		g_enum.vars = vars;
+		g_enum.n = n;
+		g_enum.mines = 0;
+		g_enum.counts = counts;
+		g_enum.tile_counts = tile_counts;
+		g_enum.stride = stride;
+		g_enum.shift = shift;
+		enumerate(0);
+		return g_enum.steps > ENUM_MAX_STEPS ? -1 : 0;
+	}
+	order = malloc(n * sizeof(int));
+	starts = malloc((n + 1) * sizeof(int));
+	if (!order || !starts) {
+		fputs("Out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	/* Find the pieces left without v, breadth-first through the
+	 * constraints. order lists them by position in vars, so each piece
+	 * stays in breadth-first order. */
+	g_enum.fixed[v] = 1;
+	for (i = 0; i < n; ++i) {
+		g_enum.in_piece[vars[i]] = 0;
+		g_enum.pos[vars[i]] = i;
+	}
+	for (i = 0, k = 0; i < n; ++i) {
+		int head;
+		if (i == mid || g_enum.in_piece[vars[i]]) continue;
+		starts[n_pieces++] = k;
+		g_enum.in_piece[vars[i]] = 1;
+		order[k++] = i;
+		for (head = k - 1; head < k; ++head) {
+			int w = vars[order[head]];
+			for (j = 0; j < g_var_n_cons[w]; ++j) {
+				const struct constraint *c =
+					&g_cons[g_var_cons[w][j]];
+				int m;
+				for (m = 0; m < c->n_vars; ++m) {
+					int u = c->vars[m];
+					if (g_enum.fixed[u] || g_enum.in_piece[u])
+						continue;
+					g_enum.in_piece[u] = 1;
+					order[k++] = g_enum.pos[u];
+				}
+			}
+		}
+	}
+	starts[n_pieces] = k;
+	for (val = 0; val <= 1 && g_enum.steps <= ENUM_MAX_STEPS; ++val) {
+		double **piece_counts, **piece_tiles, *total, *others, *tmp;
+		int ok = 1, p, q, len;
+		++g_enum.steps;
+		for (j = 0; j < g_var_n_cons[v]; ++j) {
+			const struct constraint *c = &g_cons[g_var_cons[v][j]];
+			int m, unfixed = 0;
+			for (m = 0; m < c->n_vars; ++m) {
+				unfixed += !g_enum.fixed[c->vars[m]];
+			}
+			g_enum.need[g_var_cons[v][j]] -= val;
+			if (g_enum.need[g_var_cons[v][j]] < 0
+			 || g_enum.need[g_var_cons[v][j]] > unfixed)
+				ok = 0;
+		}
+		piece_counts = malloc((n_pieces + 1) * sizeof(double *));
+		piece_tiles = malloc((n_pieces + 1) * sizeof(double *));
+		if (!piece_counts || !piece_tiles) {
+			fputs("Out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		/* Count each piece on its own. */
+		for (p = 0; p < n_pieces; ++p) {
+			int size = starts[p + 1] - starts[p];
+			int *piece;
+			piece_counts[p] = zeros(size + 1);
+			piece_tiles[p] = zeros(size * (size + 1));
+			if (!ok) continue;
+			piece = malloc(size * sizeof(int));
+			if (!piece) {
+				fputs("Out of memory\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+			for (i = 0; i < size; ++i) {
+				piece[i] = vars[order[starts[p] + i]];
+			}
+			count_vars(piece, size, depth + 1, piece_counts[p],
+				piece_tiles[p], size + 1, 0);
+			free(piece);
+		}
+		for (j = 0; j < g_var_n_cons[v]; ++j) {
+			g_enum.need[g_var_cons[v][j]] += val;
+		}
+		/* Convolve them all for the counts, and all but one for each
+		 * piece's tiles. */
+		total = zeros(n + 1);
+		others = zeros(n + 1);
+		tmp = zeros(n + 1);
+		total[0] = 1;
+		len = 1;
+		for (p = 0; p < n_pieces && ok; ++p) {
+			int size = starts[p + 1] - starts[p];
+			convolve(total, len, piece_counts[p], size + 1, tmp);
+			len += size;
+			memcpy(total, tmp, len * sizeof(double));
+		}
+		for (i = 0; i < len && ok; ++i) {
+			counts[i + val + shift] += total[i];
+			if (val) tile_counts[mid * stride + i + 1 + shift]
+				+= total[i];
+		}
+		for (p = 0; p < n_pieces && ok; ++p) {
+			int size = starts[p + 1] - starts[p], o_len = 1;
+			others[0] = 1;
+			for (q = 0; q < n_pieces; ++q) {
+				int q_size = starts[q + 1] - starts[q];
+				if (q == p) continue;
+				convolve(others, o_len, piece_counts[q],
+					q_size + 1, tmp);
+				o_len += q_size;
+				memcpy(others, tmp, o_len * sizeof(double));
+			}
+			for (i = 0; i < size; ++i) {
+				double *row = tile_counts + order[starts[p] + i]
+					* stride + val + shift;
+				convolve(piece_tiles[p] + i * (size + 1),
+					size + 1, others, o_len, tmp);
+				for (k = 0; k < size + o_len; ++k) {
+					row[k] += tmp[k];
+				}
+			}
+		}
+		for (p = 0; p < n_pieces; ++p) {
+			free(piece_counts[p]);
+			free(piece_tiles[p]);
+		}
+		free(piece_counts);
+		free(piece_tiles);
+		free(total);
+		free(others);
+		free(tmp);
+	}
+	g_enum.fixed[v] = 0;
+	free(order);
+	free(starts);
+	return g_enum.steps > ENUM_MAX_STEPS ? -1 : 0;
+}
+
+/** Count the solutions of component comp. With n variables in the
+  * component, counts[k] is set to the number of solutions with k mines, for
+  * k from 0 to n. tile_counts[j * (n + 1) + k] is set to the number of those
+  * in which the component's jth variable is a mine. -1 is returned if that
+  * takes more than ENUM_MAX_STEPS steps, and 0 otherwise. */
+static int count_component(int comp, double *counts, double *tile_counts)
+{
+	static int vars[MAX_TILES];
+	int i, first = g_comp_start[comp], n = g_comp_start[comp + 1] - first;
+	for (i = 0; i <= n; ++i) {
+		counts[i] = 0;
+	}
+	for (i = 0; i < n * (n + 1); ++i) {
+		tile_counts[i] = 0;
+	}
+	for (i = 0; i < g_n_cons; ++i) {
+		g_enum.need[i] = g_cons[i].need;
+	}
+	for (i = 0; i < n; ++i) {
+		vars[i] = first + i;
+	}
+	g_enum.steps = 0;
+	return count_vars(vars, n, 0, counts, tile_counts, n + 1, 0);
+}
+
+/** Compare variables by where their tiles are, for qsort(). */
+static int compare_var_places(const void *a, const void *b)
+{
+	int ta = g_var_tile[*(const int *)a], tb = g_var_tile[*(const int *)b];
+	return (ta > tb) - (ta < tb);
+}
+
+/** Compare the descriptions of two constraints in a key, for qsort(). */
+static int compare_key_cons(const void *a, const void *b)
+{
+	const int *ka = a, *kb = b;
+	int i;
+	for (i = 0; i < KEY_CON_INTS; ++i) {
+		if (ka[i] != kb[i]) return (ka[i] > kb[i]) - (ka[i] < kb[i]);
+	}
+	return 0;
+}
+
+/** Describe component comp in key so that it matches the key of any component
+  * with the same shape and numbers, wherever it is on the board. The
+  * variables are put in order of place, and rank[j] set to where the
+  * component's jth variable is in that order. The key holds the variable and
+  * constraint counts, each variable's place relative to the top left, and
+  * each constraint's need and variables in sorted order. The length of the
+  * key is returned. */
+static int component_key(int comp, int *key, int *rank)
+{
+	static int order[MAX_TILES];
+	static char seen[MAX_TILES];
+	int first = g_comp_start[comp], n = g_comp_start[comp + 1] - first;
+	int i, j, min_x = g_width, min_y = g_height, n_cons = 0;
+	int *cons = key + 2 + 2 * n;
+	for (i = 0; i < n; ++i) {
+		int at = g_var_tile[first + i];
+		order[i] = first + i;
+		if (at % g_width < min_x) min_x = at % g_width;
+		if (at / g_width < min_y) min_y = at / g_width;
+	}
+	qsort(order, n, sizeof(*order), compare_var_places);
+	key[0] = n;
+	for (i = 0; i < n; ++i) {
+		rank[order[i] - first] = i;
+		key[2 + 2 * i] = g_var_tile[order[i]] % g_width - min_x;
+		key[3 + 2 * i] = g_var_tile[order[i]] / g_width - min_y;
+	}
+	for (i = 0; i < n; ++i) {
+		for (j = 0; j < g_var_n_cons[first + i]; ++j) {
+			int con = g_var_cons[first + i][j], m, k;
+			int *rec = cons + n_cons * KEY_CON_INTS;
+			if (seen[con]) continue;
+			seen[con] = 1;
+			++n_cons;
+			rec[0] = g_cons[con].need;
+			rec[1] = g_cons[con].n_vars;
+			for (m = 0; m < KEY_CON_INTS - 2; ++m) {
+				rec[2 + m] = -1;
+			}
+			/* Insert the ranks in order. */
+			for (m = 0; m < g_cons[con].n_vars; ++m) {
+				int r = rank[g_cons[con].vars[m] - first];
+				for (k = m; k > 0 && rec[1 + k] > r; --k) {
+					rec[2 + k] = rec[1 + k];
+				}
+				rec[2 + k] = r;
+			}
+		}
+	}
+	for (i = 0; i < n; ++i) {
+		for (j = 0; j < g_var_n_cons[first + i]; ++j) {
+			seen[g_var_cons[first + i][j]] = 0;
+		}
+	}
+	qsort(cons, n_cons, KEY_CON_INTS * sizeof(*cons), compare_key_cons);
+	key[1] = n_cons;
+	return 2 + 2 * n + n_cons * KEY_CON_INTS;
+}
+
+/** Empty the component cache. */
+static void clear_cache(void)
+{
+	int i;
+	for (i = 0; i < CACHE_BUCKETS; ++i) {
+		while (g_cache.buckets[i]) {
+			struct cache_entry *e = g_cache.buckets[i];
+			g_cache.buckets[i] = e->next;
+			free(e->key);
+			free(e->counts);
+			free(e->tile_counts);
+			free(e);
+		}
+	}
+	g_cache.n_doubles = 0;
+}
+
+/** Do what count_component() does, reusing the counts of any component with
+  * the same shape and numbers seen before. Most moves only change a few
+  * components, so the rest come from the cache. */
+static int cached_count_component(int comp, double *counts,
+	double *tile_counts)
+{
+	static int key[2 + 2 * MAX_TILES + KEY_CON_INTS * MAX_TILES];
+	static int rank[MAX_TILES];
+	struct cache_entry *e;
+	unsigned long hash = 0;
+	int key_len = component_key(comp, key, rank), n = key[0], i, k, ret;
+	for (i = 0; i < key_len; ++i) {
+		hash = keyed_hash(hash, U32((unsigned long)key[i]));
+	}
+	for (e = g_cache.buckets[hash % CACHE_BUCKETS]; e; e = e->next) {
+		if (e->hash == hash && e->key_len == key_len
+		 && !memcmp(e->key, key, key_len * sizeof(*key)))
+			break;
+	}
+	if (e) {
+		++g_cache.hits;
+		if (!e->counts) return -1;
+		memcpy(counts, e->counts, (n + 1) * sizeof(*counts));
+		for (i = 0; i < n; ++i) {
+			for (k = 0; k <= n; ++k) {
+				tile_counts[i * (n + 1) + k] =
+					e->tile_counts[rank[i] * (n + 1) + k];
+			}
+		}
+		return 0;
+	}
+	++g_cache.misses;
+	ret = count_component(comp, counts, tile_counts);
+	if (g_cache.n_doubles + (long)(n + 1) * (n + 1) > CACHE_MAX_DOUBLES)
+		clear_cache();
+	e = calloc(1, sizeof(*e));
+	if (!e) goto out_of_memory;
+	e->hash = hash;
+	e->key_len = key_len;
+	e->n = n;
+	e->key = malloc(key_len * sizeof(*key));
+	if (!e->key) goto out_of_memory;
+	memcpy(e->key, key, key_len * sizeof(*key));
+	if (!ret) {
+		e->counts = malloc((n + 1) * sizeof(double));
+		e->tile_counts = malloc((n * (n + 1) + 1) * sizeof(double));
+		if (!e->counts || !e->tile_counts) goto out_of_memory;
+		memcpy(e->counts, counts, (n + 1) * sizeof(double));
+		for (i = 0; i < n; ++i) {
+			memcpy(e->tile_counts + rank[i] * (n + 1),
+				tile_counts + i * (n + 1),
+				(n + 1) * sizeof(double));
+		}
+		g_cache.n_doubles += (long)(n + 1) * (n + 1);
+	}
+	e->next = g_cache.buckets[hash % CACHE_BUCKETS];
+	g_cache.buckets[hash % CACHE_BUCKETS] = e;
+	return ret;
+
+out_of_memory:
+	fputs("Out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+	return -1;
+}
+
+/** Get the state reached by assigning val in the sweep step from the state
+  * mask, or -1 if that breaks a constraint. The next state's mask is put in
+  * *next. */
+static int sweep_next(const struct sweep_step *st, unsigned long mask, int val,
+	unsigned long *next)
+{
+	unsigned long ext = mask | (unsigned long)val << st->n_live;
+	int i;
+	for (i = 0; i < st->n_cons; ++i) {
+		int sum = count_bits(ext & st->con_mask[i]);
+		if (sum > st->need[i] || sum + st->left[i] < st->need[i])
+			return -1;
+	}
+	*next = 0;
+	for (i = 0; i < st->n_keep; ++i) {
+		*next |= (ext >> st->keep[i] & 1) << i;
+	}
+	return 0;
+}
+
+/** Find the state with the mask among the n sorted states. */
+static struct sweep_state *find_state(struct sweep_state *states, int n,
+	unsigned long mask)
+{
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (states[mid].mask < mask) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return &states[lo];
+}
+
+/** Order sweep states by mask, for qsort(). */
+static int compare_states(const void *a, const void *b)
+{
+	unsigned long ma = ((const struct sweep_state *)a)->mask;
+	unsigned long mb = ((const struct sweep_state *)b)->mask;
+	return ma < mb ? -1 : ma > mb;
+}
+
+/** Set *x and *y to the coordinates of frontier variable v, swapped if
+  * swap is nonzero. */
+static void var_coords(int v, int swap, int *x, int *y)
+{
+	int at = g_var_tile[v];
+	*x = swap ? at / g_width : at % g_width;
+	*y = swap ? at % g_width : at / g_width;
+}
+
+/** Plan a sweep of component comp into sw. The variables are assigned column
+  * by column, or row by row if swap is nonzero. A variable stays live until
+  * every constraint it is in has all its variables assigned. The most
+  * variables live at once is returned, or SWEEP_MAX_LIVE + 1 if there are more
+  * than SWEEP_MAX_LIVE. */
+static int plan_sweep(int comp, struct sweep *sw, int swap)
+{
+	static int pos[MAX_TILES], death[MAX_TILES], live[SWEEP_MAX_LIVE + 2];
+	int first = g_comp_start[comp], n = g_comp_start[comp + 1] - first;
+	int i, j, x, y, n_live, max_live;
+	/* Insertion sort by sweep position; components are mostly sorted. */
+	sw->n = n;
+	for (i = 0; i < n; ++i) {
+		int v = first + i, vx, vy;
+		var_coords(v, swap, &vx, &vy);
+		for (j = i; j > 0; --j) {
+			var_coords(sw->order[j - 1], swap, &x, &y);
+			if (x < vx || (x == vx && y < vy)) break;
+			sw->order[j] = sw->order[j - 1];
+		}
+		sw->order[j] = v;
+	}
+	for (i = 0; i < n; ++i) {
+		pos[sw->order[i]] = i;
+	}
+	/* A variable dies after the last variable of its constraints. */
+	for (i = 0; i < n; ++i) {
+		int v = sw->order[i];
+		death[i] = i;
+		for (j = 0; j < g_var_n_cons[v]; ++j) {
+			const struct constraint *c = &g_cons[g_var_cons[v][j]];
+			int k;
+			for (k = 0; k < c->n_vars; ++k) {
+				if (pos[c->vars[k]] > death[i])
+					death[i] = pos[c->vars[k]];
+			}
+		}
+	}
+	n_live = max_live = 0;
+	for (i = 0; i < n; ++i) {
+		struct sweep_step *st = &sw->steps[i];
+		int v = sw->order[i];
+		st->n_live = n_live;
+		st->n_cons = g_var_n_cons[v];
+		live[n_live] = i;
+		for (j = 0; j < st->n_cons; ++j) {
+			const struct constraint *c = &g_cons[g_var_cons[v][j]];
+			int k, b;
+			st->con_mask[j] = 0;
+			st->need[j] = c->need;
+			st->left[j] = 0;
+			for (k = 0; k < c->n_vars; ++k) {
+				if (pos[c->vars[k]] > i) {
+					++st->left[j];
+					continue;
+				}
+				for (b = 0; live[b] != pos[c->vars[k]]; ++b)
+					;
+				st->con_mask[j] |= 1UL << b;
+			}
+		}
+		st->n_keep = 0;
+		for (j = 0; j <= n_live; ++j) {
+			if (death[live[j]] > i) {
+				st->keep[st->n_keep] = j;
+				live[st->n_keep++] = live[j];
+			}
+		}
+		n_live = st->n_keep;
+		if (n_live > max_live) max_live = n_live;
+		if (max_live > SWEEP_MAX_LIVE) break;
+	}
+	return max_live;
+}
+
+/** Make room for len more counts in the sweep's arena, all zero. The offset of
+  * the first is returned. */
+static long sweep_alloc(struct sweep *sw, int len)
+{
+	long at = sw->arena_len;
+	if (sw->arena_len + len > sw->arena_cap) {
+		sw->arena_cap = (sw->arena_len + len) * 2;
+		sw->arena = realloc(sw->arena, sw->arena_cap * sizeof(double));
+		if (!sw->arena) {
+			fputs("Out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	memset(sw->arena + at, 0, len * sizeof(double));
+	sw->arena_len += len;
+	return at;
+}
+
+/** Count the solutions of the planned sweep by dynamic programming. The states
+  * after each step are the distinct values of the live variables, each with
+  * the ways to reach it counted by mines placed so far. Work is linear in the
+  * number of variables and at most exponential in how many are live at once.
+  * counts[k] is set as for count_component(). The states are kept for
+  * sweep_tile_weights(). -1 is returned if a step reaches more than
+  * SWEEP_MAX_STATES states, and 0 otherwise. */
+static int count_sweep(struct sweep *sw, double *counts)
+{
+	struct sweep_state *next;
+	int i, j, k, val;
+	sw->arena_len = 0;
+	for (i = 0; i <= sw->n; ++i) {
+		sw->states[i] = NULL;
+	}
+	sweep_alloc(sw, 1);
+	sw->states[0] = malloc(sizeof(struct sweep_state));
+	if (!sw->states[0]) goto out_of_memory;
+	sw->n_states[0] = 1;
+	sw->states[0]->mask = 0;
+	sw->states[0]->k_min = 0;
+	sw->states[0]->k_len = 1;
+	sw->states[0]->at = 0;
+	sw->arena[0] = 1;
+	for (i = 0; i < sw->n; ++i) {
+		const struct sweep_step *st = &sw->steps[i];
+		struct sweep_state *from = sw->states[i];
+		int n_next = 0;
+		next = malloc((2 * sw->n_states[i] + 1) * sizeof(*next));
+		if (!next) goto out_of_memory;
+		/* Find the reachable states and their ranges of mine counts. */
+		for (j = 0; j < sw->n_states[i]; ++j) {
+			for (val = 0; val <= 1; ++val) {
+				unsigned long mask;
+				if (sweep_next(st, from[j].mask, val, &mask))
+					continue;
+				next[n_next].mask = mask;
+				next[n_next].k_min = from[j].k_min + val;
+				next[n_next].k_len = from[j].k_len;
+				++n_next;
+			}
+		}
+		qsort(next, n_next, sizeof(*next), compare_states);
+		for (j = k = 0; j < n_next; ++j) {
+			if (k > 0 && next[k - 1].mask == next[j].mask) {
+				struct sweep_state *s = &next[k - 1];
+				int end = s->k_min + s->k_len;
+				if (next[j].k_min + next[j].k_len > end)
+					end = next[j].k_min + next[j].k_len;
+				if (next[j].k_min < s->k_min)
+					s->k_min = next[j].k_min;
+				s->k_len = end - s->k_min;
+			} else {
+				next[k++] = next[j];
+			}
+		}
+		n_next = k;
+		sw->states[i + 1] = next;
+		sw->n_states[i + 1] = n_next;
+		if (n_next > SWEEP_MAX_STATES) return -1;
+		for (j = 0; j < n_next; ++j) {
+			next[j].at = sweep_alloc(sw, next[j].k_len);
+		}
+		/* Add up the ways to reach each of them. */
+		for (j = 0; j < sw->n_states[i]; ++j) {
+			for (val = 0; val <= 1; ++val) {
+				struct sweep_state *to;
+				unsigned long mask;
+				if (sweep_next(st, from[j].mask, val, &mask))
+					continue;
+				to = find_state(next, n_next, mask);
+				for (k = 0; k < from[j].k_len; ++k) {
+					sw->arena[to->at + from[j].k_min + val
+						- to->k_min + k] +=
+						sw->arena[from[j].at + k];
+				}
+			}
+		}
+	}
+	for (k = 0; k <= sw->n; ++k) {
+		counts[k] = 0;
+	}
+	/* Every variable is dead at the end, so there is at most one state. */
+	if (sw->n_states[sw->n] > 0) {
+		struct sweep_state *s = sw->states[sw->n];
+		for (k = 0; k < s->k_len; ++k) {
+			counts[s->k_min + k] = sw->arena[s->at + k];
+		}
+	}
+	return 0;
+
+out_of_memory:
+	fputs("Out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+/** Given the weight of a whole solution by its number of mines, add to
+  * weights[v] the total weight of the solutions in which variable v of the
+  * component is a mine. This goes backwards through the states of the sweep,
+  * working out for each the weight of finishing from it by how many mines it
+  * started with, and combines that with the forward counts at each step. */
+static void sweep_tile_weights(struct sweep *sw, const double *comp_weight,
+	double *weights)
+{
+	/* Parallel to the arena: the weight of finishing from each state. */
+	double *back;
+	int i, j, k, val;
+	back = calloc(sw->arena_len + 1, sizeof(double));
+	if (!back) {
+		fputs("Out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (sw->n_states[sw->n] > 0) {
+		struct sweep_state *last = sw->states[sw->n];
+		for (k = 0; k < last->k_len; ++k) {
+			back[last->at + k] = comp_weight[last->k_min + k];
+		}
+	}
+	for (i = sw->n; i-- > 0; ) {
+		struct sweep_state *from = sw->states[i];
+		for (j = 0; j < sw->n_states[i]; ++j) {
+			for (val = 0; val <= 1; ++val) {
+				struct sweep_state *to;
+				unsigned long mask;
+				long at;
+				if (sweep_next(&sw->steps[i], from[j].mask, val,
+					&mask))
+					continue;
+				to = find_state(sw->states[i + 1],
+					sw->n_states[i + 1], mask);
+				at = to->at + from[j].k_min + val - to->k_min;
+				for (k = 0; k < from[j].k_len; ++k) {
+					back[from[j].at + k] += back[at + k];
+					if (val) {
+						weights[sw->order[i]] +=
+							back[at + k] * sw->arena[
+							from[j].at + k];
+					}
+				}
+			}
+		}
+	}
+	free(back);
+}
+
+/** Free a sweep along with any states it has counted. */
+static void free_sweep(struct sweep *sw)
+{
+	int i;
+	if (!sw) return;
+	if (sw->arena) {
+		for (i = 0; i <= sw->n; ++i) {
+			free(sw->states[i]);
+		}
+		free(sw->arena);
+	}
+	free(sw);
+}
+
+/** Get the natural logarithm of n choose k. */
+static double log_choose(int n, int k)
+{
+	static int filled = 0;
+	if (!filled) {
+		int i;
+		g_log_fact[0] = 0;
+		for (i = 1; i <= MAX_TILES; ++i) {
+			g_log_fact[i] = g_log_fact[i - 1] + log((double)i);
+		}
+		filled = 1;
+	}
+	return g_log_fact[n] - g_log_fact[k] - g_log_fact[n - k];
+}
+
+/** Calculate the exact chance that each hidden, unflagged tile has a mine,
+  * given what the player can see. Flags are taken to be correct. Every
+  * arrangement of the remaining mines consistent with the revealed numbers is
+  * equally likely. The frontier is split into independent components whose
+  * solutions are counted by mine count. The components are combined under the
+  * total number of mines, weighting each frontier mine count by the ways to
+  * put the rest in the interior. Those weights are computed from logarithms
+  * and scaled so they cannot overflow. prob[y][x] is set to the chance, or to
+  * -1 for revealed and flagged tiles. -1 is returned if nothing is consistent
+  * with the board, -2 if a component is too big to count, and 0 otherwise.
+  * Large components that are narrow along some axis are swept instead of
+  * enumerated, since enumerating is exponential in their size. */
+static int mine_probabilities(double prob[MAX_HEIGHT][MAX_WIDTH])
+{
+	double **counts, **tile_counts, **prefix, *suffix, *weight, *others,
+		*comp_weight, *next, *var_weight, total, interior;
+	struct sweep **sweeps;
+	int c, i, j, k, left, live, x, y, ret = 0;
+	build_frontier();
+	left = g_n_mines - g_n_flags;
+	counts = calloc(g_n_comps + 1, sizeof(*counts));
+	tile_counts = calloc(g_n_comps + 1, sizeof(*tile_counts));
+	sweeps = calloc(g_n_comps + 1, sizeof(*sweeps));
+	var_weight = malloc((g_n_vars + 1) * sizeof(*var_weight));
+	prefix = calloc(g_n_comps + 1, sizeof(*prefix));
+	suffix = malloc((g_n_vars + 1) * sizeof(*suffix));
+	next = malloc((g_n_vars + 1) * sizeof(*next));
+	others = malloc((g_n_vars + 1) * sizeof(*others));
+	weight = malloc((g_n_vars + 1) * sizeof(*weight));
+	comp_weight = malloc((g_n_vars + 1) * sizeof(*comp_weight));
+	if (!counts || !tile_counts || !sweeps || !var_weight || !prefix
+	 || !suffix || !next || !others || !weight || !comp_weight)
+		goto out_of_memory;
+	/* Count each component, and convolve the counts from the left so that
+	 * prefix[c] is the distribution of mines in components before c. */
+	prefix[0] = malloc(sizeof(double));
+	if (!prefix[0]) goto out_of_memory;
+	prefix[0][0] = 1;
+	for (c = 0; c < g_n_comps; ++c) {
+		int n = g_comp_start[c + 1] - g_comp_start[c];
+		int before = g_comp_start[c];
+		counts[c] = malloc((n + 1) * sizeof(double));
+		tile_counts[c] = NULL;
+		prefix[c + 1] = malloc((before + n + 1) * sizeof(double));
+		if (!counts[c] || !prefix[c + 1]) goto out_of_memory;
+		if (n > SWEEP_MIN_VARS) {
+			struct sweep *across;
+			int live_across;
+			sweeps[c] = calloc(1, sizeof(struct sweep));
+			across = calloc(1, sizeof(struct sweep));
+			if (!sweeps[c] || !across) {
+				free(across);
+				goto out_of_memory;
+			}
+			/* Plan both axes once and sweep along whichever keeps
+			 * fewer live. */
+			live = plan_sweep(c, sweeps[c], 0);
+			live_across = plan_sweep(c, across, 1);
+			if (live_across < live) {
+				struct sweep *down = sweeps[c];
+				sweeps[c] = across;
+				across = down;
+				live = live_across;
+			}
+			free(across);
+			if (live > SWEEP_MAX_LIVE
+			 || count_sweep(sweeps[c], counts[c])) {
+				free_sweep(sweeps[c]);
+				sweeps[c] = NULL;
+			}
+		}
+		if (!sweeps[c]) {
+			tile_counts[c] = malloc((n * (n + 1) + 1)
+				* sizeof(double));
+			if (!tile_counts[c]) goto out_of_memory;
+			if (cached_count_component(c, counts[c],
+				tile_counts[c])) {
+				ret = -2;
+				goto done;
+			}
+		}
+		convolve(prefix[c], before + 1, counts[c], n + 1, prefix[c + 1]);
+	}
+	/* weight[t] is proportional to the ways to fit the remaining mines in
+	 * the interior given t mines on the frontier. */
+	{
+		double max_log = -HUGE_VAL;
+		for (i = 0; i <= g_n_vars; ++i) {
+			int rest = left - i;
+			if (rest >= 0 && rest <= g_n_interior) {
+				double l = log_choose(g_n_interior, rest);
+				if (l > max_log) max_log = l;
+			}
+		}
+		for (i = 0; i <= g_n_vars; ++i) {
+			int rest = left - i;
+			weight[i] = rest >= 0 && rest <= g_n_interior
+				? exp(log_choose(g_n_interior, rest) - max_log)
+				: 0;
+		}
+	}
+	total = interior = 0;
+	for (i = 0; i <= g_n_vars; ++i) {
+		double w = prefix[g_n_comps][i] * weight[i];
+		total += w;
+		if (g_n_interior > 0)
+			interior += w * (left - i) / g_n_interior;
+	}
+	if (!(total > 0)) {
+		ret = -1;
+		goto done;
+	}
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			prob[y][x] = g_board[y][x].revealed
+				|| g_board[y][x].flagged ? -1 : interior / total;
+		}
+	}
+	/* Go back through the components, keeping in suffix the distribution
+	 * of mines in the components after c. */
+	suffix[0] = 1;
+	for (c = g_n_comps; c-- > 0; ) {
+		int first = g_comp_start[c];
+		int n = g_comp_start[c + 1] - first;
+		int after = g_n_vars - g_comp_start[c + 1];
+		convolve(prefix[c], first + 1, suffix, after + 1, others);
+		/* comp_weight[k] is the weight of one solution of this
+		 * component with k mines. */
+		for (k = 0; k <= n; ++k) {
+			comp_weight[k] = 0;
+			for (j = 0; j <= first + after; ++j) {
+				comp_weight[k] += others[j] * weight[k + j];
+			}
+		}
+		for (i = first; i < first + n; ++i) {
+			var_weight[i] = 0;
+			if (sweeps[c]) continue;
+			for (k = 0; k <= n; ++k) {
+				var_weight[i] += tile_counts[c][(i - first)
+					* (n + 1) + k] * comp_weight[k];
+			}
+		}
+		if (sweeps[c]) {
+			sweep_tile_weights(sweeps[c], comp_weight, var_weight);
+		}
+		for (i = first; i < first + n; ++i) {
+			j = g_var_tile[i];
+			prob[j / g_width][j % g_width] = var_weight[i] / total;
+		}
+		convolve(suffix, after + 1, counts[c], n + 1, next);
+		memcpy(suffix, next, (after + n + 1) * sizeof(*suffix));
+	}
+done:
+	for (c = 0; c < g_n_comps; ++c) {
+		free(counts[c]);
+		free(tile_counts[c]);
+		free_sweep(sweeps[c]);
+		free(prefix[c + 1]);
+	}
+	free(prefix[0]);
+	free(counts);
+	free(tile_counts);
+	free(sweeps);
+	free(var_weight);
+	free(prefix);
+	free(suffix);
+	free(next);
+	free(others);
+	free(weight);
+	free(comp_weight);
+	return ret;
+
+out_of_memory:
+	fputs("Out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+	return -1;
+}
+
+/** Get a character representing the tile at (x, y). */
+static int tile_char(int x, int y)
+{
+	struct tile t = g_board[y][x];
+	if (t.revealed) {
+		if (t.mine) {
+			return '*';
+		} else {
+			if (t.around > 0) {
+				return '0' + t.around;
+			} else {
+				return ' ';
+			}
+		}
+	} else if (t.flagged) {
+		return 'F';
+	} else {
+		return '@';
+	}
+}
+
+/** Print the row of column names "A B C..." to stdout. */
+static void print_column_names(void)
+{
+	int x;
+	printf("    ");
+	for (x = 0; x < g_width; ++x) {
+		printf(" %c", alphabet[x]);
+	}
+	putchar('\n');
+}
+
+/** Print a border to stdout the right width for the board. */
+static void print_horiz_border(void)
+{
+	int x;
+	printf("    -");
+	for (x = 0; x < g_width; ++x) {
+		printf(" -");
+	}
+	putchar('\n');
+}
+
+/** The state of one chain of sample_probabilities(). */
+static struct {
+	/* Whether each tile has a mine. Flagged tiles always do. */
+	char mine[MAX_TILES];
+	/* The hidden, unflagged tiles with and without mines, and where each
+	 * tile is in whichever of those lists it is in. */
+	int mines[MAX_TILES], n_mines, safes[MAX_TILES], n_safes;
+	int at[MAX_TILES];
+	/* The number of mines in the interior. */
+	int interior_mines;
+	/* The key and count of the chain's random draws. */
+	unsigned long key, n_draws;
+} g_chain;
+
+/** Get a random number from 0 to below - 1 from the chain's own stream, so
+  * that sampling does not change the game's draws. */
+static int chain_below(int below)
+{
+	return (int)(keyed_hash(g_chain.key, g_chain.n_draws++) % below);
+}
+
+/** Check that every revealed number around tile i sees as many mines in
+  * g_chain as it says. */
+static int chain_fits(int i)
+{
+	int x = i % g_width, y = i / g_width, angle;
+	for (angle = 0; angle < 8; ++angle) {
+		int ax = x + cosine(angle);
+		int ay = y + sine(angle);
+		int around = 0, a2;
+		if (ax < 0 || ax >= g_width || ay < 0 || ay >= g_height
+		 || !g_board[ay][ax].revealed)
+			continue;
+		for (a2 = 0; a2 < 8; ++a2) {
+			int bx = ax + cosine(a2);
+			int by = ay + sine(a2);
+			if (bx >= 0 && bx < g_width && by >= 0 && by < g_height)
+				around += g_chain.mine[by * g_width + bx];
+		}
+		if (around != g_board[ay][ax].around) return 0;
+	}
+	return 1;
+}
+
+/** Move tile i of g_chain from the list of safe tiles to the list of mines,
+  * or back if mine is zero. */
+static void chain_set(int i, int mine)
+{
+	int *from = mine ? g_chain.safes : g_chain.mines;
+	int *n_from = mine ? &g_chain.n_safes : &g_chain.n_mines;
+	int *to = mine ? g_chain.mines : g_chain.safes;
+	int *n_to = mine ? &g_chain.n_mines : &g_chain.n_safes;
+	if (g_chain.mine[i] == mine) return;
+	g_chain.mine[i] = (char)mine;
+	from[g_chain.at[i]] = from[--*n_from];
+	g_chain.at[from[g_chain.at[i]]] = g_chain.at[i];
+	g_chain.at[i] = *n_to;
+	to[(*n_to)++] = i;
+}
+
+/** Scatter mines evenly over the interior of g_chain so that it holds n. */
+static void chain_scatter(int n)
+{
+	int i, pool = g_n_interior, n_tiles = g_width * g_height;
+	g_chain.interior_mines = n;
+	for (i = 0; i < n_tiles; ++i) {
+		struct tile *t = &g_board[i / g_width][i % g_width];
+		if (t->revealed || t->flagged || g_tile_var[i] >= 0) continue;
+		chain_set(i, chain_below(pool--) < n);
+		n -= g_chain.mine[i];
+	}
+}
+
+/** Start g_chain from an arrangement consistent with the board. The SAT
+  * solver finds the frontier's mines, with flags assumed to be mines and its
+  * saved values shuffled so that each chain starts somewhere different. The
+  * rest are scattered over the interior. -1 is returned if that does not
+  * leave the right number for the interior, and 0 otherwise. */
+static int start_chain(void)
+{
+	static int flags[MAX_TILES];
+	int i, n_tiles = g_width * g_height, n_flags = 0, frontier = 0, rest;
+	for (i = 0; i < g_sat.n_decide; ++i) {
+		g_sat.phase[g_sat.decide[i]] = (signed char)chain_below(2);
+	}
+	for (i = 0; i < n_tiles; ++i) {
+		if (g_board[i / g_width][i % g_width].flagged)
+			flags[n_flags++] = 2 * i;
+	}
+	if (!sat_solve(flags, n_flags)) {
+		sat_backtrack(0);
+		return -1;
+	}
+	g_chain.n_mines = g_chain.n_safes = 0;
+	for (i = 0; i < n_tiles; ++i) {
+		struct tile *t = &g_board[i / g_width][i % g_width];
+		g_chain.mine[i] = t->flagged;
+		if (t->revealed || t->flagged) continue;
+		if (g_tile_var[i] >= 0 && g_sat.value[i] == 1) {
+			g_chain.mine[i] = 1;
+			++frontier;
+		}
+	}
+	sat_backtrack(0);
+	rest = g_n_mines - g_n_flags - frontier;
+	if (rest < 0 || rest > g_n_interior) return -1;
+	for (i = 0; i < n_tiles; ++i) {
+		struct tile *t = &g_board[i / g_width][i % g_width];
+		if (t->revealed || t->flagged) continue;
+		if (g_chain.mine[i]) {
+			g_chain.at[i] = g_chain.n_mines;
+			g_chain.mines[g_chain.n_mines++] = i;
+		} else {
+			g_chain.at[i] = g_chain.n_safes;
+			g_chain.safes[g_chain.n_safes++] = i;
+		}
+	}
+	chain_scatter(rest);
+	return 0;
+}
+
+/** Propose moving a mine in g_chain to a tile without one, both picked at
+  * random, and make the move if every number still fits. The proposal is as
+  * likely as its reverse, so every consistent arrangement is equally likely in
+  * the long run. */
+static void chain_step(void)
+{
+	int m, s, from, to;
+	if (g_chain.n_mines == 0 || g_chain.n_safes == 0) return;
+	m = chain_below(g_chain.n_mines);
+	s = chain_below(g_chain.n_safes);
+	from = g_chain.mines[m];
+	to = g_chain.safes[s];
+	g_chain.mine[from] = 0;
+	g_chain.mine[to] = 1;
+	if (!chain_fits(from) || !chain_fits(to)) {
+		g_chain.mine[from] = 1;
+		g_chain.mine[to] = 0;
+		return;
+	}
+	g_chain.mines[m] = to;
+	g_chain.at[to] = m;
+	g_chain.safes[s] = from;
+	g_chain.at[from] = s;
+	g_chain.interior_mines += (g_tile_var[to] < 0) - (g_tile_var[from] < 0);
+}
+
+/** Pick a frontier variable at random, take the SAMPLE_BLOCK variables
+  * nearest it through shared numbers, and rearrange the mines among them and
+  * the interior. Each arrangement of the block that fits the numbers is
+  * chosen in proportion to the ways to put the remaining mines in the
+  * interior, and then the interior is scattered afresh. Which variables are
+  * taken does not depend on the mines, so this leaves every consistent
+  * arrangement equally likely. Swaps alone cannot get between arrangements
+  * that differ in several places at once, such as the two sides of a 50/50,
+  * or that have different numbers of mines on the frontier; this can. */
+static void chain_block(void)
+{
+	static char in_block[MAX_TILES], con_seen[MAX_TILES];
+	int vars[SAMPLE_BLOCK], n_vars = 0, cons[SAMPLE_BLOCK * 8], n_cons = 0;
+	int need[SAMPLE_BLOCK * 8], masks[SAMPLE_BLOCK * 8];
+	int head, i, j, k = 0, mask, pass;
+	double weight[SAMPLE_BLOCK + 1], total = 0, pick = 0;
+	if (g_n_vars == 0) return;
+	vars[n_vars++] = chain_below(g_n_vars);
+	in_block[vars[0]] = 1;
+	for (head = 0; head < n_vars; ++head) {
+		int v = vars[head];
+		for (i = 0; i < g_var_n_cons[v]; ++i) {
+			const struct constraint *c = &g_cons[g_var_cons[v][i]];
+			for (j = 0; j < c->n_vars && n_vars < SAMPLE_BLOCK; ++j) {
+				if (in_block[c->vars[j]]) continue;
+				in_block[c->vars[j]] = 1;
+				vars[n_vars++] = c->vars[j];
+			}
+		}
+	}
+	/* For each number the block touches, work out the mines it needs
+	 * from the block and which block variables it sees. */
+	for (i = 0; i < n_vars; ++i) {
+		int v = vars[i];
+		k += g_chain.mine[g_var_tile[v]];
+		for (j = 0; j < g_var_n_cons[v]; ++j) {
+			int con = g_var_cons[v][j], m;
+			const struct constraint *c = &g_cons[con];
+			if (con_seen[con]) continue;
+			con_seen[con] = 1;
+			cons[n_cons] = con;
+			need[n_cons] = c->need;
+			masks[n_cons] = 0;
+			for (m = 0; m < c->n_vars; ++m) {
+				int w = c->vars[m], b;
+				if (!in_block[w]) {
+					need[n_cons] -= g_chain.mine[g_var_tile[w]];
+					continue;
+				}
+				for (b = 0; vars[b] != w; ++b)
+					;
+				masks[n_cons] |= 1 << b;
+			}
+			++n_cons;
+		}
+	}
+	for (i = 0; i < n_vars; ++i) {
+		in_block[vars[i]] = 0;
+	}
+	for (i = 0; i < n_cons; ++i) {
+		con_seen[cons[i]] = 0;
+	}
+	/* weight[j] is the ways to fill the interior if the block has j
+	 * mines, relative to the ways now. */
+	for (j = 0; j <= n_vars; ++j) {
+		int rest = g_chain.interior_mines + k - j;
+		weight[j] = rest < 0 || rest > g_n_interior ? 0
+			: exp(log_choose(g_n_interior, rest) - log_choose(
+				g_n_interior, g_chain.interior_mines));
+	}
+	/* Total the weights of the arrangements that fit, then go through
+	 * them again to pick one. */
+	for (pass = 0; pass < 2; ++pass) {
+		for (mask = 0; mask < 1 << n_vars; ++mask) {
+			int bits = count_bits(mask);
+			if (weight[bits] == 0) continue;
+			for (i = 0; i < n_cons; ++i) {
+				if (count_bits(mask & masks[i]) != need[i]) break;
+			}
+			if (i < n_cons) continue;
+			if (pass == 0) {
+				total += weight[bits];
+				continue;
+			}
+			if ((pick -= weight[bits]) >= 0) continue;
+			for (i = 0; i < n_vars; ++i) {
+				chain_set(g_var_tile[vars[i]], mask >> i & 1);
+			}
+			if (bits != k)
+				chain_scatter(g_chain.interior_mines + k - bits);
+			return;
+		}
+		pick = total * chain_below(0x10000) / 0x10000;
+	}
+}
+
+/** Estimate the chance that each hidden, unflagged tile has a mine when
+  * mine_probabilities() would take too long. SAMPLE_CHAINS Markov chains
+  * start from different arrangements and each runs for its share of
+  * g_sample_time milliseconds, the first fifth of it discarded. The chains
+  * take turns, one after another. A sample is taken after as many proposals
+  * as there are hidden tiles. prob is set as for mine_probabilities().
+  * *error is set to the largest standard error of any tile's chance, from
+  * the means of batches of SAMPLE_BATCH samples. *rhat is set to the largest
+  * Gelman-Rubin statistic over the tiles, which is near 1 when the chains
+  * agree. The number of samples is returned, or -1 if no chain could start. */
+static long sample_probabilities(double prob[MAX_HEIGHT][MAX_WIDTH],
+	double *error, double *rhat)
+{
+	/* Per chain and tile, the samples with a mine; then over every batch
+	 * of every chain, the sums of the batch means and their squares. */
+	static double hits[SAMPLE_CHAINS][MAX_TILES];
+	static double batch_sum[MAX_TILES], batch_squares[MAX_TILES];
+	static int batch_hits[MAX_TILES];
+	long samples[SAMPLE_CHAINS], n_batches = 0, total = 0;
+	int c, i, n_chains = 0, n_tiles = g_width * g_height;
+	clock_t share = (clock_t)((double)g_sample_time * CLOCKS_PER_SEC / 1000
+		/ SAMPLE_CHAINS);
+	sat_sync();
+	build_frontier();
+	memset(batch_sum, 0, sizeof(batch_sum));
+	memset(batch_squares, 0, sizeof(batch_squares));
+	for (c = 0; c < SAMPLE_CHAINS; ++c) {
+		clock_t start = clock(), now;
+		int n_samples = 0;
+		g_chain.key = keyed_hash(g_seed ^ 0x5A3C96E1UL, (unsigned long)c);
+		g_chain.n_draws = 0;
+		if (start_chain()) continue;
+		memset(hits[n_chains], 0, sizeof(hits[n_chains]));
+		memset(batch_hits, 0, sizeof(batch_hits));
+		samples[n_chains] = 0;
+		do {
+			for (i = 0; i < g_chain.n_mines + g_chain.n_safes; ++i) {
+				chain_step();
+				if (i % SAMPLE_BLOCK == 0) chain_block();
+			}
+			now = clock();
+			if (now - start < share / 5) continue;
+			for (i = 0; i < n_tiles; ++i) {
+				hits[n_chains][i] += g_chain.mine[i];
+				batch_hits[i] += g_chain.mine[i];
+			}
+			++samples[n_chains];
+			if (++n_samples < SAMPLE_BATCH) continue;
+			for (i = 0; i < n_tiles; ++i) {
+				double mean = (double)batch_hits[i] / SAMPLE_BATCH;
+				batch_sum[i] += mean;
+				batch_squares[i] += mean * mean;
+				batch_hits[i] = 0;
+			}
+			++n_batches;
+			n_samples = 0;
+		} while (now - start < share);
+		total += samples[n_chains];
+		++n_chains;
+	}
+	if (n_chains == 0) return -1;
+	*error = *rhat = 0;
+	for (i = 0; i < n_tiles; ++i) {
+		int x = i % g_width, y = i / g_width;
+		double sum = 0, within = 0, between = 0, mean;
+		if (g_board[y][x].revealed || g_board[y][x].flagged) {
+			prob[y][x] = -1;
+			continue;
+		}
+		for (c = 0; c < n_chains; ++c) {
+			sum += hits[c][i];
+		}
+		prob[y][x] = mean = total > 0 ? sum / total : 0;
+		if (n_batches > 1) {
+			double m = batch_sum[i] / n_batches;
+			double var = (batch_squares[i] - n_batches * m * m)
+				/ (n_batches - 1);
+			if (var > 0 && sqrt(var / n_batches) > *error)
+				*error = sqrt(var / n_batches);
+		}
+		/* Each sample is 0 or 1, so a chain's variance follows from its
+		 * mean. */
+		for (c = 0; c < n_chains; ++c) {
+			double n = samples[c], p;
+			if (n < 2) break;
+			p = hits[c][i] / n;
+			within += p * (1 - p) * n / (n - 1) / n_chains;
+			between += (p - mean) * (p - mean) / (n_chains - 1);
+		}
+		if (c == n_chains && n_chains > 1 && within > 0) {
+			double n = (double)total / n_chains;
+			double r = sqrt(((n - 1) / n * within + between) / within);
+			if (r > *rhat) *rhat = r;
+		}
+	}
+	return total;
+}
+
+/** Get a character showing the chance of a mine at (x, y) from g_prob, in
+  * tenths from 0 to 9. Certain mines are M and certainly safe tiles are S,
+  * unless the chances are estimates. Revealed tiles are blank, and flags are
+  * F. */
+static int prob_char(int x, int y)
+{
+	double p = g_prob[y][x];
+	if (g_board[y][x].revealed) return ' ';
+	if (g_board[y][x].flagged) return 'F';
+	if (g_prob_sampled) return p < 1 ? '0' + (int)(p * 10) : '9';
+	if (p < 1e-9) return 'S';
+	if (p > 1 - 1e-9) return 'M';
+	return '0' + (int)(p * 10);
+}
+
+/** Print a grid of characters from tile_fn(x, y) with borders and labels.
+  * Prints out g_separator first. */
+static void print_grid(int (*tile_fn)(int x, int y))
+{
+	int y;
+	printf("%s", g_separator);
+	print_column_names();
+	print_horiz_border();
+	for (y = 0; y < g_height; ++y) {
+		int x;
+		int row = y + 1;
+		printf("%2d |", row);
+		for (x = 0; x < g_width; ++x) {
+			printf("`%c", tile_fn(x, y));
+		}
+		printf("`| %d\n", row);
+	}
+	print_horiz_border();
+	print_column_names();
+}
+
+/** Print out the board, borders and all. Prints out g_separator first. */
+static void print_board(void)
+{
+	if (g_quiet) return;
+	print_grid(tile_char);
+	printf("Flags: %d/%d\n", g_n_flags, g_n_mines);
+}
+
+/** Read a line of stdin. Leading whitespace is skipped. If stdin at the EOF, -1
+  * is returned. The number of characters after the whitespace, excluding the
+  * newline, is otherwise returned. The newline is not read into buf with the
+  * rest. If the characters after the whitespace outnumber max, a number larger
+  * than max is returned, but only max characters are read into buf. buf is not
+  * NUL terminated. */
+static int read_input(char *buf, int max)
+{
+	int i = 0;
+	int ch;
+	do {
+		ch = getchar();
+		if (ch == '\n' || ch == EOF) goto finished;
+	} while (isspace(ch));
+	for (i = 0; i < max; ++i) {
+		buf[i] = ch;
+		if (ch == '\n' || ch == EOF) goto finished;
+		ch = getchar();
+	}
+	while (ch != '\n' && ch != EOF) {
+		ch = getchar();
+		++i;
+	}
+finished:
+	if (i == 0 && feof(stdin)) return -1;
+	return i;
+}
+
+/** Parse a location (e.g. "C12") from input into *x and *y. If the input was
+  * invalid, -1 is returned. */
+static int parse_location(const char *input, int *x, int *y)
 {
 	char *letter = memchr(alphabet, toupper(input[0]), sizeof(alphabet));
 	if (!letter) return -1;
@@ -436,46 +4088,198 @@ static int parse_location(const char *input, int *x, int *y)
 	return 0;
 }
 
+/** Print the message and a newline to stdout unless g_quiet is set. */
+static void print_message(const char *msg)
+{
+	if (!g_quiet) puts(msg);
+}
+
+/** Flush the journal if any commands are waiting to be written. */
+static void flush_journal(void)
+{
+	if (!g_journal || g_journal_pending == 0) return;
+	fflush(g_journal);
+	g_journal_pending = 0;
+	g_journal_flushed = time(NULL);
+}
+
+/** Flush the journal if enough commands or time have built up since the last
+  * flush. This batches the writes so that a move does not always cost a trip
+  * to the disk. The cost is that a crash loses the commands made since the
+  * last flush: fewer than JOURNAL_BATCH, all within JOURNAL_INTERVAL seconds
+  * of it, however long the player has waited since. */
+static void sync_journal(void)
+{
+	if (g_journal_pending >= JOURNAL_BATCH
+	 || difftime(time(NULL), g_journal_flushed) >= JOURNAL_INTERVAL)
+		flush_journal();
+}
+
+/** Append the command to the journal, if one is open. */
+static void journal_command(const char *input)
+{
+	if (!g_journal) return;
+	fprintf(g_journal, "%s\n", input);
+	++g_journal_pending;
+	sync_journal();
+}
+
+/** Close and delete the journal, if there is one. This is done when the game
+  * ends, since a finished game has nothing to recover. */
+static void end_journal(void)
+{
+	if (!g_journal) return;
+	fclose(g_journal);
+	g_journal = NULL;
+	remove(g_journal_path);
+}
+
 /** Prints to stdout concluding information. Don't use g_board after this. */
 static void print_quit_info(void)
 {
 	init_board(); /* Only gets initialized if it currently is not. */
 	reveal_all();
 	print_board();
-	puts("Game quit.");
+	print_message("Game quit.");
 }
 
 /** Run the command specified in input on the global state. This will print
   * stuff to stdout. Returned is whether or not the game should continue. */
 static int run_command(const char *input)
 {
-	int x, y;
+	int x, y, n_moves, cascade;
+	long n_samples = 0;
+	double error = 0, rhat = 0;
 	switch (*input) {
 	case '\0':
 		print_board();
 		return 1;
-	case 'f':
-		if (parse_location(input + 1, &x, &y)) break;
-		if (!g_board[x][y].revealed) {
-			init_board();
-			if (g_board[x][y].flagged) {
-				g_board[x][y].flagged = 0;
-				--g_n_flags;
-				g_n_found -= g_board[x][y].mine;
-			} else {
-				g_board[x][y].flagged = 1;
-				++g_n_flags;
-				g_n_found += g_board[x][y].mine;
-			}
-			if (g_n_found == g_n_mines && g_n_flags == g_n_found) {
-				reveal_all();
-				print_board();
-				puts("All mines found! You win!");
-				return 0;
-			}
+	case 'f':
+		if (parse_location(input + 1, &x, &y)) break;
+		begin_move();
+		switch (flag_move(x, y)) {
+		case REFUSED:
+			break;
+		case WON:
+			reveal_all();
+			print_board();
+			print_message("All mines found! You win!");
+			return 0;
+		default:
+			journal_command(input);
+			break;
+		}
+		print_board();
+		return 1;
+	case 'c':
+		cascade = g_cascade || input[1] == 'c';
+		if (parse_location(input + 1 + (input[1] == 'c'), &x, &y))
+			break;
+		begin_move();
+		switch (chord_move(x, y, cascade)) {
+		case REFUSED:
+			print_message("Only a number with all its flags can be"
+				" chorded.");
+			return 1;
+		case LOST:
+			reveal_all();
+			print_board();
+			print_message("A wrong flag led to a mine! Game over.");
+			return 0;
+		default:
+			break;
+		}
+		/* Journal the mode used, in case the game is resumed without
+		 * the option. */
+		if (cascade && input[1] != 'c') {
+			char cmd[CMD_MAX + 2];
+			cmd[0] = 'c';
+			strcpy(cmd + 1, input);
+			journal_command(cmd);
+		} else {
+			journal_command(input);
+		}
+		print_board();
+		return 1;
+	case 'u':
+		if (input[1] != '\0') break;
+		begin_move();
+		if (undo_move() == REFUSED) {
+			print_message("There is nothing to undo.");
+			return 1;
+		}
+		journal_command(input);
+		print_board();
+		return 1;
+	case 'y':
+		if (input[1] != '\0') break;
+		begin_move();
+		if (redo_move() == REFUSED) {
+			print_message("There is nothing to redo.");
+			return 1;
+		}
+		journal_command(input);
+		print_board();
+		return 1;
+	case 's':
+		if (input[1] != '\0') break;
+		if (!g_board_initialized) {
+			print_message("Reveal a tile before solving.");
+			return 1;
+		}
+		begin_move();
+		switch (solve(&n_moves)) {
+		case WON:
+			reveal_all();
+			print_board();
+			print_message("All mines found! You win!");
+			return 0;
+		case LOST:
+			reveal_all();
+			print_board();
+			print_message("A wrong flag led to a mine! Game over.");
+			return 0;
+		default:
+			break;
+		}
+		if (n_moves == 0) {
+			print_message("Nothing can be deduced.");
+			return 1;
 		}
+		journal_command(input);
 		print_board();
 		return 1;
+	case 'p':
+		if (input[1] != '\0') break;
+		g_prob_sampled = 0;
+		switch (mine_probabilities(g_prob)) {
+		case -1:
+			print_message("The flags and numbers contradict.");
+			return 1;
+		case -2:
+			n_samples = sample_probabilities(g_prob, &error, &rhat);
+			if (n_samples < 0) {
+				print_message("No arrangement of mines fits.");
+				return 1;
+			}
+			g_prob_sampled = 1;
+			break;
+		default:
+			break;
+		}
+		if (g_quiet) return 1;
+		print_grid(prob_char);
+		if (g_prob_sampled) {
+			printf("Estimated chance of a mine in tenths from %ld"
+				" samples.\n", n_samples);
+			printf("Standard error at most %.3f, R-hat at most"
+				" %.3f.\n", error, rhat);
+		} else {
+			puts("Chance of a mine in tenths. S is safe, M is a mine.");
+			printf("Reused %lu of %lu component counts.\n",
+				g_cache.hits, g_cache.hits + g_cache.misses);
+		}
+		return 1;
 	case 'h':
 	case '?':
 		print_help(stdout);
@@ -495,38 +4299,1075 @@ static int run_command(const char *input)
 		/* FALLTHROUGH */
 	default:
 		if (parse_location(input, &x, &y)) break;
-		if (!g_board_initialized) {
-			init_board();
-			make_space(x, y);
-		}
-		if (g_board[x][y].flagged) {
-			puts("Unflag the space before you reveal it.");
+		begin_move();
+		switch (reveal_move(x, y)) {
+		case REFUSED:
+			print_message("Unflag the space before you reveal it.");
 			return 1;
-		} else if (!reveal(x, y)) {
+		case LOST:
 			reveal_all();
 			print_board();
-			puts("You hit a mine! Game over.");
+			print_message("You hit a mine! Game over.");
 			return 0;
-		} else {
+		default:
+			journal_command(input);
 			print_board();
 			return 1;
 		}
 	}
-	puts("Invalid command. Use command '?' for help.");
+	print_message("Invalid command. Use command '?' for help.");
+	return 1;
+}
+
+/** Fail with a message about the journal file. */
+static void journal_error(const char *progname, const char *what)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, g_journal_path, what);
+	exit(EXIT_FAILURE);
+}
+
+/** Cut the journal old, open at g_journal_path, back to its first kept
+  * bytes, so that commands appended later do not run on from a line cut off
+  * by a crash. It is rewritten, as C89 cannot truncate a file in place. */
+static void drop_torn_line(const char *progname, FILE *old, long kept)
+{
+	FILE *to;
+	char *buf = malloc((size_t)kept + 1);
+	if (!buf) {
+		fputs("Out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	rewind(old);
+	if (fread(buf, 1, (size_t)kept, old) != (size_t)kept)
+		journal_error(progname, "Could not read journal");
+	to = fopen(g_journal_path, "w");
+	if (!to || fwrite(buf, 1, (size_t)kept, to) != (size_t)kept
+	 || fclose(to))
+		journal_error(progname, "Could not open journal");
+	free(buf);
+}
+
+/** Open g_journal_path for the game. If it holds an unfinished game, the board
+  * settings and seed are taken from its header and its commands are run
+  * without printing anything. Otherwise a new journal is started for the
+  * current settings. Returned is whether or not the game should continue. */
+static int open_journal(const char *progname)
+{
+	/* The longest line is a command with the 'c' -cascade adds, its
+	 * newline and the terminator. */
+	char line[CMD_MAX + 3];
+	int n_moves = 0;
+	int playing = 1, torn = 0;
+	long kept = 0;
+	FILE *old = fopen(g_journal_path, "r");
+	if (old) {
+		int width, height, n_mines, gen = 0;
+		struct stats_range range = {0, MAX_TILES, 0, MAX_TILES, 0,
+			MAX_TILES};
+		unsigned long seed;
+		char header[80];
+		/* Older journals have no generation options or ranges. */
+		if (!fgets(header, sizeof(header), old)
+		 || sscanf(header, "mines %d %d %d %lu %d %d %d %d %d %d %d",
+			&width, &height, &n_mines, &seed, &gen,
+			&range.min_3bv, &range.max_3bv,
+			&range.min_openings, &range.max_openings,
+			&range.min_largest, &range.max_largest) < 4
+		 || width < MIN_WIDTH || width > MAX_WIDTH
+		 || height < MIN_HEIGHT || height > MAX_HEIGHT
+		 || n_mines < MIN_MINES || n_mines > width * height)
+			journal_error(progname, "Not a valid journal");
+		g_width = width;
+		g_height = height;
+		g_n_mines = n_mines;
+		g_seed = U32(seed);
+		g_gen = gen;
+		g_range = range;
+		clear_board();
+		start_recording(progname);
+		g_quiet = 1;
+		kept = ftell(old);
+		while (playing && fgets(line, sizeof(line), old)) {
+			char *end = strchr(line, '\n');
+			if (!end) {
+				/* A crash while writing leaves the last line
+				 * cut off. It is dropped with what was being
+				 * written. */
+				if (getc(old) == EOF) {
+					torn = 1;
+					break;
+				}
+				journal_error(progname, "Command too long");
+			}
+			*end = '\0';
+			playing = run_command(line);
+			++n_moves;
+			kept = ftell(old);
+		}
+		g_quiet = 0;
+		if (torn) drop_torn_line(progname, old, kept);
+		fclose(old);
+	}
+	if (!playing) {
+		remove(g_journal_path);
+		print_board();
+		puts("The journaled game was already over.");
+		return 0;
+	}
+	g_journal = fopen(g_journal_path, old ? "a" : "w");
+	if (!g_journal) journal_error(progname, "Could not open journal");
+	if (old) {
+		printf("Recovered %d moves from %s.\n", n_moves,
+			g_journal_path);
+	} else {
+		fprintf(g_journal, "mines %d %d %d %lu %d %d %d %d %d %d %d\n",
+			g_width, g_height, g_n_mines, g_seed, g_gen,
+			g_range.min_3bv, g_range.max_3bv,
+			g_range.min_openings, g_range.max_openings,
+			g_range.min_largest, g_range.max_largest);
+		fflush(g_journal);
+	}
+	g_journal_flushed = time(NULL);
 	return 1;
 }
 
+/** Fail with a message about the replay file. */
+static void replay_error(const char *progname, const char *what)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, g_replay_path, what);
+	exit(EXIT_FAILURE);
+}
+
+/** Read a number written by write_varint() from data[*at], reading no further
+  * than data[end - 1]. *at is moved past the number. -1 is returned if the
+  * number is cut off or too long. */
+static int read_varint(const unsigned char *data, size_t *at, size_t end,
+	unsigned long *n)
+{
+	int shift;
+	*n = 0;
+	for (shift = 0; *at < end && shift < 32; shift += 7) {
+		int byte = data[(*at)++];
+		*n |= (unsigned long)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) return 0;
+	}
+	return -1;
+}
+
+/** Read g_replay_path into g_replay and set up the board settings from its
+  * header. Moves are indexed but not applied. */
+static void load_replay(const char *progname)
+{
+	FILE *from;
+	long size;
+	size_t at, end, plane_size;
+	unsigned long n, flags, elapsed = 0;
+	unsigned long header[6], range[6];
+	int i;
+	from = fopen(g_replay_path, "rb");
+	if (!from) replay_error(progname, "Could not open replay");
+	if (fseek(from, 0, SEEK_END) || (size = ftell(from)) < 0
+	 || fseek(from, 0, SEEK_SET))
+		replay_error(progname, "Could not read replay");
+	end = (size_t)size;
+	/* Every move takes at least a byte, so there are at most end moves. */
+	g_replay.data = malloc(end + 1);
+	g_replay.moves = malloc((end + 1) * sizeof(*g_replay.moves));
+	g_replay.keyframe_moves = malloc((end + 1) * sizeof(int));
+	g_replay.keyframe_offsets = malloc((end + 1) * sizeof(size_t));
+	if (!g_replay.data || !g_replay.moves || !g_replay.keyframe_moves
+	 || !g_replay.keyframe_offsets)
+		replay_error(progname, "Replay too large");
+	if (fread(g_replay.data, 1, end, from) != end)
+		replay_error(progname, "Could not read replay");
+	fclose(from);
+	at = strlen(REPLAY_MAGIC);
+	if (end < at || memcmp(g_replay.data, REPLAY_MAGIC, at))
+		replay_error(progname, "Not a replay");
+	for (i = 0; i < 6; ++i) {
+		if (read_varint(g_replay.data, &at, end, &header[i]))
+			replay_error(progname, "Truncated header");
+	}
+	if (header[0] != REPLAY_VERSION)
+		replay_error(progname, "Unsupported replay version");
+	if (header[1] < MIN_WIDTH || header[1] > MAX_WIDTH
+	 || header[2] < MIN_HEIGHT || header[2] > MAX_HEIGHT
+	 || header[3] > header[1] * header[2])
+		replay_error(progname, "Invalid board settings");
+	g_width = (int)header[1];
+	g_height = (int)header[2];
+	g_n_mines = (int)header[3];
+	clear_board();
+	g_seed = U32(header[4]);
+	flags = header[5];
+	g_gen = (int)(flags >> REPLAY_GEN_SHIFT);
+	if (g_gen & GEN_RANGE) {
+		for (i = 0; i < 6; ++i) {
+			if (read_varint(g_replay.data, &at, end, &range[i]))
+				replay_error(progname, "Truncated header");
+		}
+		if (range[0] > range[1] || range[1] > MAX_TILES
+		 || range[2] > range[3] || range[3] > MAX_TILES
+		 || range[4] > range[5] || range[5] > MAX_TILES)
+			replay_error(progname, "Invalid board settings");
+		g_range.min_3bv = (int)range[0];
+		g_range.max_3bv = (int)range[1];
+		g_range.min_openings = (int)range[2];
+		g_range.max_openings = (int)range[3];
+		g_range.min_largest = (int)range[4];
+		g_range.max_largest = (int)range[5];
+	}
+	if (flags & REPLAY_TIMES) {
+		g_replay.times = malloc((end + 1) * sizeof(unsigned long));
+		if (!g_replay.times) replay_error(progname, "Replay too large");
+	}
+	plane_size = (size_t)(g_width * g_height + 7) / 8;
+	while (at < end) {
+		size_t start = at;
+		if (read_varint(g_replay.data, &at, end, &n))
+			replay_error(progname, "Truncated move");
+		switch (n & 7) {
+		case REPLAY_UNDO:
+		case REPLAY_REDO:
+			g_replay.moves[g_replay.n_moves] = start;
+			for (n >>= 3; n > 0; --n) {
+				unsigned long change;
+				if (read_varint(g_replay.data, &at, end,
+					&change))
+					replay_error(progname,
+						"Truncated move");
+				if (change >> 1
+				 >= (unsigned long)(g_width * g_height))
+					replay_error(progname,
+						"Move out of bounds");
+			}
+			goto read_time;
+		case REPLAY_REVEAL:
+		case REPLAY_FLAG:
+			if (n >> 3 >= (unsigned long)(g_width * g_height))
+				replay_error(progname, "Move out of bounds");
+			g_replay.moves[g_replay.n_moves] = start;
+		read_time:
+			if (g_replay.times) {
+				unsigned long seconds;
+				if (read_varint(g_replay.data, &at, end,
+					&seconds))
+					replay_error(progname,
+						"Truncated move");
+				elapsed += seconds;
+				g_replay.times[g_replay.n_moves] = elapsed;
+			}
+			++g_replay.n_moves;
+			break;
+		case REPLAY_KEYFRAME:
+			i = g_replay.n_keyframes++;
+			g_replay.keyframe_moves[i] = g_replay.n_moves;
+			g_replay.keyframe_offsets[i] = at;
+			if (read_varint(g_replay.data, &at, end, &n)
+			 || read_varint(g_replay.data, &at, end, &n)
+			 || end - at < 3 * plane_size)
+				replay_error(progname, "Truncated keyframe");
+			at += 3 * plane_size;
+			break;
+		default:
+			replay_error(progname, "Invalid move");
+		}
+	}
+}
+
+/** Get bit i of the packed bit plane. */
+#define PLANE_BIT(plane, i) ((plane)[(i) / 8] >> (i) % 8 & 1)
+
+/** Set g_board to the state recorded by the keyframe at data[at]. */
+static void restore_keyframe(size_t at)
+{
+	static const struct tile blank;
+	const unsigned char *mines, *revealed, *flagged;
+	unsigned long outcome;
+	int i, n_tiles = g_width * g_height;
+	size_t plane_size = (size_t)(n_tiles + 7) / 8;
+	/* The keyframe was checked by load_replay(). */
+	read_varint(g_replay.data, &at, (size_t)-1, &outcome);
+	read_varint(g_replay.data, &at, (size_t)-1, &g_n_draws);
+	g_replay.outcome = (enum outcome)outcome;
+	mines = g_replay.data + at;
+	revealed = mines + plane_size;
+	flagged = revealed + plane_size;
+	g_n_flags = g_n_found = 0;
+	g_board_initialized = 0;
+	for (i = 0; i < n_tiles; ++i) {
+		struct tile *t = &g_board[i / g_width][i % g_width];
+		*t = blank;
+		t->mine = PLANE_BIT(mines, i);
+		t->revealed = PLANE_BIT(revealed, i);
+		t->flagged = PLANE_BIT(flagged, i);
+		g_n_flags += t->flagged;
+		g_n_found += t->flagged & t->mine;
+		/* Only flags can come before the mines are placed. */
+		g_board_initialized |= t->mine;
+	}
+	for (i = 0; i < n_tiles; ++i) {
+		if (PLANE_BIT(mines, i)) add_around(i % g_width, i / g_width, 1);
+	}
+	recount_around();
+}
+
+/** Put g_board in the state after the first n moves of g_replay. This starts
+  * from the latest keyframe at or before move n, unless the current state is
+  * already closer, so each seek costs at most REPLAY_KEYFRAME_INTERVAL moves. */
+static void seek_replay(int n)
+{
+	int lo = 0, hi = g_replay.n_keyframes;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (g_replay.keyframe_moves[mid] <= n) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (n < g_replay.at
+	 || (lo > 0 && g_replay.keyframe_moves[lo - 1] > g_replay.at)) {
+		if (lo > 0) {
+			restore_keyframe(g_replay.keyframe_offsets[lo - 1]);
+			g_replay.at = g_replay.keyframe_moves[lo - 1];
+		} else {
+			clear_board();
+			g_n_flags = g_n_found = 0;
+			g_n_draws = 0;
+			g_replay.at = 0;
+			g_replay.outcome = PLAYING;
+		}
+	}
+	for (; g_replay.at < n; ++g_replay.at) {
+		size_t at = g_replay.moves[g_replay.at];
+		unsigned long move, change;
+		int kind, x, y;
+		read_varint(g_replay.data, &at, (size_t)-1, &move);
+		kind = (int)(move & 7);
+		x = (int)(move >> 3) % g_width;
+		y = (int)(move >> 3) / g_width;
+		switch (kind) {
+		case REPLAY_FLAG:
+			g_replay.outcome = flag_move(x, y);
+			break;
+		case REPLAY_REVEAL:
+			g_replay.outcome = reveal_move(x, y);
+			break;
+		default:
+			for (move >>= 3; move > 0; --move) {
+				read_varint(g_replay.data, &at, (size_t)-1,
+					&change);
+				apply_change((int)change,
+					kind == REPLAY_UNDO);
+			}
+			g_replay.outcome = PLAYING;
+			break;
+		}
+	}
+}
+
+/** Print the board and where the replay is at. */
+static void print_replay_position(void)
+{
+	print_board();
+	printf("Move %d of %d", g_replay.at, g_replay.n_moves);
+	if (g_replay.times && g_replay.at > 0)
+		printf(", %lu seconds in", g_replay.times[g_replay.at - 1]);
+	puts(".");
+	if (g_replay.at > 0) {
+		if (g_replay.outcome == WON) {
+			puts("All mines found!");
+		} else if (g_replay.outcome == LOST) {
+			puts("A mine was hit.");
+		}
+	}
+}
+
+/** Play back g_replay_path. The board is not drawn until the end of the game
+  * is reached, after which commands from stdin step through it. */
+static void run_replay(const char *progname)
+{
+	char cmd[CMD_MAX + 1];
+	int len;
+	g_keep_changes = 0;
+	load_replay(progname);
+	seek_replay(g_replay.n_moves);
+	print_replay_position();
+	while ((len = read_input(cmd, CMD_MAX)) >= 0) {
+		int n;
+		cmd[len <= CMD_MAX ? len : CMD_MAX] = '\0';
+		switch (cmd[0]) {
+		case '\0':
+			break;
+		case 'n':
+			if (g_replay.at < g_replay.n_moves)
+				seek_replay(g_replay.at + 1);
+			break;
+		case 'p':
+			if (g_replay.at > 0) seek_replay(g_replay.at - 1);
+			break;
+		case 'g':
+			n = atoi(cmd + 1);
+			if (n < 0) n = 0;
+			if (n > g_replay.n_moves) n = g_replay.n_moves;
+			seek_replay(n);
+			break;
+		case 'q':
+			return;
+		default:
+			puts("Invalid command. Use n, p, g<number> or q.");
+			continue;
+		}
+		print_replay_position();
+	}
+}
+
 /** Calculate and return the player score based on the global state. */
 static long calc_score(void)
 {
 	return (long)g_n_found * (long)g_n_found * 1000 / g_width / g_height;
 }
 
+/** Fail with a message about the checkpoint file. */
+static void checkpoint_error(const char *progname, const char *what)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, g_checkpoint_path, what);
+	exit(EXIT_FAILURE);
+}
+
+/** Save seed as the last seed searched to g_checkpoint_path, writing to
+  * tmp_path first so that the old checkpoint stays whole until the new one
+  * replaces it. The seeds found so far are flushed first, so none are lost on
+  * carrying on, though those found since may be printed twice. */
+static void save_checkpoint(const char *progname, const char *tmp_path,
+	unsigned long seed)
+{
+	FILE *to;
+	fflush(stdout);
+	to = fopen(tmp_path, "w");
+	if (!to) checkpoint_error(progname, "Could not save checkpoint");
+	fprintf(to, "mines search %lu\n", seed);
+	if (fclose(to) || rename(tmp_path, g_checkpoint_path))
+		checkpoint_error(progname, "Could not save checkpoint");
+}
+
+/** Fail with a message about the corpus file. */
+static void corpus_error(const char *progname, const char *what)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, g_corpus_path, what);
+	exit(EXIT_FAILURE);
+}
+
+/** Write n to the corpus with write_varint(), counting the bytes. */
+static void corpus_varint(unsigned long n)
+{
+	write_varint(g_corpus.to, n);
+	do {
+		++g_corpus.at;
+		n >>= 7;
+	} while (n > 0);
+}
+
+/** Write the low n bits of bits to the corpus, least significant first. Full
+  * bytes are put out as they fill. */
+static void corpus_bits(unsigned long bits, int n)
+{
+	for (; n > 0; --n, bits >>= 1) {
+		g_corpus.bits |= (int)(bits & 1) << g_corpus.n_bits;
+		if (++g_corpus.n_bits == 8) {
+			putc(g_corpus.bits, g_corpus.to);
+			++g_corpus.at;
+			g_corpus.bits = g_corpus.n_bits = 0;
+		}
+	}
+}
+
+/** Get the Rice parameter that codes the gaps between n_set tiles set at
+  * random among n_tiles in the fewest bits on average. The gaps are nearly
+  * geometric, so a gap of g costs k + 1 + g / 2^k bits with parameter k, and
+  * g / 2^k averages q^(2^k) / (1 - q^(2^k)), where q is the chance a tile is
+  * not set. */
+static int rice_parameter(int n_set, int n_tiles)
+{
+	double q = 1 - (double)n_set / n_tiles, best_cost = HUGE_VAL;
+	int k, best = 0;
+	if (n_set == 0 || q <= 0) return 0;
+	for (k = 0; k <= RICE_MAX; ++k) {
+		double qm = pow(q, (double)(1L << k));
+		double cost = k + 1 + qm / (1 - qm);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = k;
+		}
+	}
+	return best;
+}
+
+/** Write the mines on the board to the corpus with CORPUS_RICE. The gap
+  * before each tile coded, the tiles skipped since the last, is written as
+  * g_corpus.rice low bits after the rest in unary: that many 1 bits and a 0.
+  * The board is padded to a whole byte. */
+static void write_rice(void)
+{
+	int i, last = -1, n_tiles = g_width * g_height;
+	int safe = g_corpus.flags & CORPUS_SAFE_GAPS ? 1 : 0;
+	for (i = 0; i < n_tiles; ++i) {
+		int gap, rest;
+		if (g_board[i / g_width][i % g_width].mine == safe) continue;
+		gap = i - last - 1;
+		last = i;
+		for (rest = gap >> g_corpus.rice; rest > 0; --rest) {
+			corpus_bits(1, 1);
+		}
+		corpus_bits(0, 1);
+		corpus_bits((unsigned long)gap, g_corpus.rice);
+	}
+	corpus_bits(0, (8 - g_corpus.n_bits) % 8);
+}
+
+/** Start writing the corpus to g_corpus_path. The header holds the board
+  * settings, the first reveal (x, y) the boards were made for, the ranges
+  * they fit, what is stored for each board and the boards in each block. */
+static void start_corpus(const char *progname, int x, int y)
+{
+	int n_tiles = g_width * g_height;
+	g_corpus.flags = (g_corpus_around ? CORPUS_AROUND : 0)
+		| (g_show_stats ? CORPUS_STATS : 0);
+	if (g_corpus_rice) {
+		g_corpus.flags |= CORPUS_RICE;
+		if (g_n_mines * 2 > n_tiles) g_corpus.flags |= CORPUS_SAFE_GAPS;
+		g_corpus.rice = rice_parameter(g_n_mines * 2 > n_tiles
+			? n_tiles - g_n_mines : g_n_mines, n_tiles);
+	}
+	g_corpus.to = fopen(g_corpus_path, "wb");
+	if (!g_corpus.to) corpus_error(progname, "Could not open corpus");
+	setvbuf(g_corpus.to, NULL, _IOFBF, CORPUS_BUFFER);
+	fputs(CORPUS_MAGIC, g_corpus.to);
+	g_corpus.at = strlen(CORPUS_MAGIC);
+	corpus_varint(CORPUS_VERSION);
+	corpus_varint(g_width);
+	corpus_varint(g_height);
+	corpus_varint(g_n_mines);
+	corpus_varint(g_gen);
+	corpus_varint(x);
+	corpus_varint(y);
+	corpus_varint(g_corpus.flags);
+	corpus_varint(CORPUS_BLOCK);
+	if (g_corpus.flags & CORPUS_RICE) corpus_varint(g_corpus.rice);
+	if (g_gen & GEN_RANGE) {
+		corpus_varint(g_range.min_3bv);
+		corpus_varint(g_range.max_3bv);
+		corpus_varint(g_range.min_openings);
+		corpus_varint(g_range.max_openings);
+		corpus_varint(g_range.min_largest);
+		corpus_varint(g_range.max_largest);
+	}
+}
+
+/** Write the board to the corpus: the seed, then a bit for each tile with a
+  * mine or with CORPUS_RICE the gaps between them, then the numbers and stats
+  * if asked for. Every CORPUS_BLOCK boards, where the next starts is kept for
+  * the index. */
+static void write_corpus_board(unsigned long seed,
+	const struct board_stats *st)
+{
+	int i, n_tiles = g_width * g_height;
+	if (g_corpus.n_boards % CORPUS_BLOCK == 0) {
+		g_corpus.blocks = grow(g_corpus.blocks, &g_corpus.cap_blocks,
+			g_corpus.n_blocks + 1, sizeof(*g_corpus.blocks));
+		g_corpus.blocks[g_corpus.n_blocks++] = g_corpus.at;
+	}
+	corpus_varint(seed);
+	if (g_corpus.flags & CORPUS_RICE) {
+		write_rice();
+	} else {
+		WRITE_PLANE(g_corpus.to, mine);
+		g_corpus.at += (n_tiles + 7) / 8;
+	}
+	if (g_corpus_around) {
+		for (i = 0; i < n_tiles; i += 2) {
+			int byte = g_board[i / g_width][i % g_width].around;
+			if (i + 1 < n_tiles) {
+				byte |= g_board[(i + 1) / g_width]
+					[(i + 1) % g_width].around << 4;
+			}
+			putc(byte, g_corpus.to);
+			++g_corpus.at;
+		}
+	}
+	if (g_show_stats) {
+		corpus_varint(st->three_bv);
+		corpus_varint(st->n_openings);
+		corpus_varint(st->largest_opening);
+		corpus_varint(st->n_isolated);
+	}
+	++g_corpus.n_boards;
+}
+
+/** Finish the corpus with its index: the number of boards and blocks, then
+  * how far each block starts after the one before. After the index come its
+  * offset in eight bytes, least significant first, and CORPUS_INDEX_MAGIC,
+  * so a reader can find it from the end of the file. */
+static void end_corpus(const char *progname)
+{
+	unsigned long index = g_corpus.at, prev = 0, n;
+	int i, failed;
+	corpus_varint(g_corpus.n_boards);
+	corpus_varint(g_corpus.n_blocks);
+	for (i = 0; i < g_corpus.n_blocks; ++i) {
+		corpus_varint(g_corpus.blocks[i] - prev);
+		prev = g_corpus.blocks[i];
+	}
+	for (i = 0, n = index; i < 8; ++i) {
+		putc((int)(n & 0xFF), g_corpus.to);
+		n >>= 8;
+	}
+	fputs(CORPUS_INDEX_MAGIC, g_corpus.to);
+	failed = ferror(g_corpus.to);
+	if (fclose(g_corpus.to) || failed)
+		corpus_error(progname, "Could not write corpus");
+	free(g_corpus.blocks);
+}
+
+/** Reverse the order of the low g_width bits of row. */
+static unsigned long reverse_row(unsigned long row)
+{
+	row = (row >> 1 & 0x55555555UL) | (row & 0x55555555UL) << 1;
+	row = (row >> 2 & 0x33333333UL) | (row & 0x33333333UL) << 2;
+	row = (row >> 4 & 0x0F0F0F0FUL) | (row & 0x0F0F0F0FUL) << 4;
+	row = (row >> 8 & 0x00FF00FFUL) | (row & 0x00FF00FFUL) << 8;
+	row = (row >> 16 & 0x0000FFFFUL) | (row & 0x0000FFFFUL) << 16;
+	return U32(row) >> (32 - g_width);
+}
+
+/** Transpose the 32 by 32 bit matrix m in place, so that bit x of m[y] moves
+  * to bit y of m[x]. The off-diagonal blocks are swapped at every scale
+  * from halves down to single bits, a whole row at a time. */
+static void transpose_rows(unsigned long *m)
+{
+	unsigned long mask = 0x0000FFFFUL, t;
+	int j, k;
+	for (j = 16; j != 0; j >>= 1, mask ^= mask << j) {
+		for (k = 0; k < 32; k = (k + j + 1) & ~j) {
+			t = (m[k] >> j ^ m[k + j]) & mask;
+			m[k] ^= t << j;
+			m[k + j] ^= t;
+		}
+	}
+}
+
+/** Get the canonical form of the mines on the board into best, a bit for
+  * each tile in g_height rows: of the board turned and mirrored every way
+  * that keeps its shape, the one whose rows come first in order. That is
+  * eight ways for a square board and four otherwise. */
+static void canonical_rows(unsigned long *best)
+{
+	unsigned long rows[32], turned[32];
+	int n = g_height, x, y, transposed, flips;
+	memset(rows, 0, sizeof(rows));
+	for (y = 0; y < g_height; ++y) {
+		for (x = 0; x < g_width; ++x) {
+			rows[y] |= (unsigned long)g_board[y][x].mine << x;
+		}
+	}
+	for (transposed = 0; transposed <= (g_width == g_height);
+		++transposed) {
+		if (transposed) transpose_rows(rows);
+		for (flips = 0; flips < 4; ++flips) {
+			for (y = 0; y < n; ++y) {
+				unsigned long row = rows[flips & 1 ? n - 1 - y
+					: y];
+				turned[y] = flips & 2 ? reverse_row(row) : row;
+			}
+			for (y = 0; y < n; ++y) {
+				if (turned[y] != best[y]) break;
+			}
+			if ((!transposed && !flips)
+			 || (y < n && turned[y] < best[y]))
+				memcpy(best, turned, (size_t)n * sizeof(*best));
+		}
+	}
+}
+
+/** Get whether the board is a symmetric copy of one seen before, and add it
+  * to g_seen if not. Boards are told apart by two 32-bit hashes of their
+  * canonical form, so two different boards are taken for the same with odds
+  * of about one in 2^64 for each pair. */
+static int seen_before(void)
+{
+	unsigned long rows[MAX_HEIGHT], a = 1, b = 2, at;
+	int y;
+	canonical_rows(rows);
+	for (y = 0; y < g_height; ++y) {
+		a = keyed_hash(a, rows[y]);
+		b = keyed_hash(b ^ 0x5BD1E995UL, rows[y]);
+	}
+	/* 0 marks an empty slot. */
+	a |= 1;
+	if (g_seen.n_used * 2 >= g_seen.n_slots) {
+		unsigned long *old = g_seen.slots, n_old = g_seen.n_slots, i;
+		g_seen.n_slots = n_old ? n_old * 2 : SEEN_MIN_SLOTS;
+		g_seen.slots = calloc(g_seen.n_slots * 2, sizeof(*old));
+		if (!g_seen.slots) {
+			fputs("Out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < n_old; ++i) {
+			if (!old[2 * i]) continue;
+			at = old[2 * i + 1] & (g_seen.n_slots - 1);
+			while (g_seen.slots[2 * at]) {
+				at = (at + 1) & (g_seen.n_slots - 1);
+			}
+			g_seen.slots[2 * at] = old[2 * i];
+			g_seen.slots[2 * at + 1] = old[2 * i + 1];
+		}
+		free(old);
+	}
+	for (at = b & (g_seen.n_slots - 1); g_seen.slots[2 * at];
+		at = (at + 1) & (g_seen.n_slots - 1)) {
+		if (g_seen.slots[2 * at] == a && g_seen.slots[2 * at + 1] == b)
+			return 1;
+	}
+	g_seen.slots[2 * at] = a;
+	g_seen.slots[2 * at + 1] = b;
+	++g_seen.n_used;
+	return 0;
+}
+
+/** Read a byte of the corpus being read, failing if there is none. */
+static int corpus_getc(const char *progname)
+{
+	int c = getc(g_corpus.from);
+	if (c == EOF) corpus_error(progname, "Truncated corpus");
+	++g_corpus.at;
+	return c;
+}
+
+/** Read a number written by corpus_varint(). */
+static unsigned long corpus_read_varint(const char *progname)
+{
+	unsigned long n = 0;
+	int shift, c;
+	for (shift = 0;; shift += 7) {
+		if (shift >= (int)LONG_BITS)
+			corpus_error(progname, "Invalid corpus");
+		c = corpus_getc(progname);
+		n |= (unsigned long)(c & 0x7F) << shift;
+		if (!(c & 0x80)) return n;
+	}
+}
+
+/** Read n bits written by corpus_bits(). */
+static unsigned long corpus_read_bits(const char *progname, int n)
+{
+	unsigned long bits = 0;
+	int i;
+	for (i = 0; i < n; ++i) {
+		if (g_corpus.n_bits == 0) {
+			g_corpus.bits = corpus_getc(progname);
+			g_corpus.n_bits = 8;
+		}
+		bits |= (unsigned long)(g_corpus.bits & 1) << i;
+		g_corpus.bits >>= 1;
+		--g_corpus.n_bits;
+	}
+	return bits;
+}
+
+/** Read the mines of a board from the corpus into mines, one char a tile, and
+  * check there are g_n_mines of them. */
+static void read_corpus_mines(const char *progname, char *mines)
+{
+	int i, n_tiles = g_width * g_height, n_mines = 0;
+	if (g_corpus.flags & CORPUS_RICE) {
+		int safe = g_corpus.flags & CORPUS_SAFE_GAPS ? 1 : 0;
+		int n_coded = safe ? n_tiles - g_n_mines : g_n_mines, at = -1;
+		memset(mines, safe, (size_t)n_tiles);
+		for (i = 0; i < n_coded; ++i) {
+			unsigned long gap = 0;
+			while (corpus_read_bits(progname, 1)) {
+				if (++gap > (unsigned long)n_tiles)
+					corpus_error(progname, "Invalid board");
+			}
+			gap = gap << g_corpus.rice
+				| corpus_read_bits(progname, g_corpus.rice);
+			if (gap >= (unsigned long)(n_tiles - at - 1))
+				corpus_error(progname, "Invalid board");
+			at += (int)gap + 1;
+			mines[at] = !safe;
+		}
+		g_corpus.n_bits = 0;
+	} else {
+		for (i = 0; i < n_tiles; ++i) {
+			mines[i] = (char)corpus_read_bits(progname, 1);
+		}
+		g_corpus.n_bits = 0;
+	}
+	for (i = 0; i < n_tiles; ++i) {
+		n_mines += mines[i];
+	}
+	if (n_mines != g_n_mines) corpus_error(progname, "Invalid board");
+}
+
+/** Read the corpus at path. Each board is printed with its seed, or with
+  * verify set, made again from its seed and checked against what was stored,
+  * along with the index. The settings are taken from the header. Returned is
+  * the number of boards that did not match. */
+static unsigned long read_corpus(const char *progname, const char *path,
+	int verify)
+{
+	static char mines[MAX_TILES], around[MAX_TILES];
+	unsigned char tail[12];
+	struct board_stats st, stored = {0};
+	const struct stats_range *range = &g_range;
+	unsigned long index, n, block, n_bad = 0, prev = 0, n_copies = 0;
+	int i, x, y, n_tiles;
+	g_corpus_path = path;
+	g_corpus.from = fopen(path, "rb");
+	if (!g_corpus.from) corpus_error(progname, "Could not open corpus");
+	if (fseek(g_corpus.from, -12L, SEEK_END)
+	 || fread(tail, 1, 12, g_corpus.from) != 12
+	 || memcmp(tail + 8, CORPUS_INDEX_MAGIC, 4))
+		corpus_error(progname, "Not a corpus");
+	for (i = 7, index = 0; i >= 0; --i) {
+		index = index << 8 | tail[i];
+	}
+	rewind(g_corpus.from);
+	for (i = 0; i < 4; ++i) {
+		if (corpus_getc(progname) != CORPUS_MAGIC[i])
+			corpus_error(progname, "Not a corpus");
+	}
+	if (corpus_read_varint(progname) != CORPUS_VERSION)
+		corpus_error(progname, "Unsupported corpus version");
+	g_width = (int)corpus_read_varint(progname);
+	g_height = (int)corpus_read_varint(progname);
+	g_n_mines = (int)corpus_read_varint(progname);
+	g_gen = (int)corpus_read_varint(progname);
+	x = (int)corpus_read_varint(progname);
+	y = (int)corpus_read_varint(progname);
+	g_corpus.flags = (int)corpus_read_varint(progname);
+	block = corpus_read_varint(progname);
+	if (g_corpus.flags & CORPUS_RICE)
+		g_corpus.rice = (int)corpus_read_varint(progname);
+	if (g_width < MIN_WIDTH || g_width > MAX_WIDTH
+	 || g_height < MIN_HEIGHT || g_height > MAX_HEIGHT
+	 || g_n_mines < 0 || g_n_mines > g_width * g_height
+	 || x < 0 || x >= g_width || y < 0 || y >= g_height
+	 || block == 0 || g_corpus.rice < 0 || g_corpus.rice > RICE_MAX)
+		corpus_error(progname, "Invalid board settings");
+	if (g_gen & GEN_RANGE) {
+		g_range.min_3bv = (int)corpus_read_varint(progname);
+		g_range.max_3bv = (int)corpus_read_varint(progname);
+		g_range.min_openings = (int)corpus_read_varint(progname);
+		g_range.max_openings = (int)corpus_read_varint(progname);
+		g_range.min_largest = (int)corpus_read_varint(progname);
+		g_range.max_largest = (int)corpus_read_varint(progname);
+	}
+	/* As in search_seeds(), the stats are only needed for checking. */
+	if (!(g_gen & GEN_RANGE) && !(g_corpus.flags & CORPUS_STATS))
+		range = NULL;
+	n_tiles = g_width * g_height;
+	clear_board();
+	g_board_initialized = 1;
+	for (n = 0; g_corpus.at < index; ++n) {
+		unsigned long seed;
+		if (n % block == 0) {
+			g_corpus.blocks = grow(g_corpus.blocks,
+				&g_corpus.cap_blocks, g_corpus.n_blocks + 1,
+				sizeof(*g_corpus.blocks));
+			g_corpus.blocks[g_corpus.n_blocks++] = g_corpus.at;
+		}
+		seed = corpus_read_varint(progname);
+		read_corpus_mines(progname, mines);
+		for (i = 0; g_corpus.flags & CORPUS_AROUND && i < n_tiles;
+			i += 2) {
+			int byte = corpus_getc(progname);
+			around[i] = (char)(byte & 0xF);
+			if (i + 1 < n_tiles) around[i + 1] = (char)(byte >> 4);
+		}
+		if (g_corpus.flags & CORPUS_STATS) {
+			stored.three_bv = (int)corpus_read_varint(progname);
+			stored.n_openings = (int)corpus_read_varint(progname);
+			stored.largest_opening =
+				(int)corpus_read_varint(progname);
+			stored.n_isolated = (int)corpus_read_varint(progname);
+		}
+		clear_mines();
+		for (i = 0; i < n_tiles; ++i) {
+			g_board[i / g_width][i % g_width].mine = mines[i];
+		}
+		if (g_dedup && seen_before()) {
+			++n_copies;
+			if (!verify) continue;
+		}
+		clear_mines();
+		if (verify) {
+			int bad;
+			g_seed = seed;
+			g_n_draws = 0;
+			place_mines();
+			bad = !fit_board(x, y, range, &st);
+			for (i = 0; i < n_tiles; ++i) {
+				struct tile *t;
+				t = &g_board[i / g_width][i % g_width];
+				bad |= t->mine != mines[i];
+				if (g_corpus.flags & CORPUS_AROUND)
+					bad |= t->around != around[i];
+			}
+			if (g_corpus.flags & CORPUS_STATS) {
+				bad |= st.three_bv != stored.three_bv
+					|| st.n_openings != stored.n_openings
+					|| st.largest_opening
+						!= stored.largest_opening
+					|| st.n_isolated != stored.n_isolated;
+			}
+			if (bad) {
+				printf("Board %lu, seed %lu, does not match.\n",
+					n, seed);
+				++n_bad;
+			}
+			continue;
+		}
+		for (i = 0; i < n_tiles; ++i) {
+			g_board[i / g_width][i % g_width].mine = mines[i];
+			if (mines[i]) add_around(i % g_width, i / g_width, 1);
+		}
+		printf("Seed %lu\n", seed);
+		for (i = 0; i < n_tiles; ++i) {
+			struct tile *t = &g_board[i / g_width][i % g_width];
+			if (t->mine) {
+				putchar('*');
+			} else {
+				putchar(t->around ? '0' + t->around : '.');
+			}
+			if (i % g_width == g_width - 1) putchar('\n');
+		}
+		if (g_corpus.flags & CORPUS_STATS) print_stats(&stored);
+	}
+	if (g_corpus.at != index) corpus_error(progname, "Invalid corpus");
+	if (verify) {
+		int ok = corpus_read_varint(progname) == n
+			&& corpus_read_varint(progname)
+				== (unsigned long)g_corpus.n_blocks;
+		for (i = 0; ok && i < g_corpus.n_blocks; ++i) {
+			ok = corpus_read_varint(progname)
+				== g_corpus.blocks[i] - prev;
+			prev = g_corpus.blocks[i];
+		}
+		if (!ok) {
+			puts("The index does not match the boards.");
+			++n_bad;
+		}
+		printf("Checked %lu boards.\n", n);
+		if (g_dedup) {
+			printf("%lu are symmetric copies of boards before.\n",
+				n_copies);
+		}
+	}
+	fclose(g_corpus.from);
+	free(g_corpus.blocks);
+	return n_bad;
+}
+
+/** Print the seeds from g_search_first to g_search_last whose boards fit
+  * g_range with fit_board(), along with their stats. Each seed is generated
+  * on its own from its draws, so the order they are looked at in does not
+  * matter, and a board can be made again with -seed. Progress is saved to
+  * g_checkpoint_path, if set, every CHECKPOINT_INTERVAL seconds. With
+  * g_corpus_path, the boards are written there instead. */
+static void search_seeds(const char *progname)
+{
+	struct board_stats st;
+	const struct stats_range *range = &g_range;
+	unsigned long seed = g_search_first;
+	char *tmp_path = NULL;
+	time_t saved = time(NULL);
+	int x = g_width / 2, y = g_height / 2;
+	if (g_search_from && parse_location(g_search_from, &x, &y)) {
+		fprintf(stderr, "%s: %s: Not a position on the board\n",
+			progname, g_search_from);
+		exit(EXIT_FAILURE);
+	}
+	if (g_checkpoint_path) {
+		FILE *from = fopen(g_checkpoint_path, "r");
+		tmp_path = malloc(strlen(g_checkpoint_path) + 5);
+		if (!tmp_path) {
+			fputs("Out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		sprintf(tmp_path, "%s.tmp", g_checkpoint_path);
+		if (from) {
+			unsigned long last;
+			if (fscanf(from, "mines search %lu", &last) != 1
+			 || last < g_search_first || last >= g_search_last)
+				checkpoint_error(progname,
+					"Not a valid checkpoint");
+			fclose(from);
+			seed = last + 1;
+		}
+	}
+	if (g_corpus_path) {
+		start_corpus(progname, x, y);
+		/* Without ranges or stats to write, the stats are not needed. */
+		if (!(g_gen & GEN_RANGE) && !g_show_stats) range = NULL;
+	}
+	clear_board();
+	g_board_initialized = 1;
+	for (;; ++seed) {
+		g_seed = seed;
+		g_n_draws = 0;
+		clear_mines();
+		place_mines();
+		if (fit_board(x, y, range, &st)
+		 && !(g_dedup && seen_before())) {
+			if (g_corpus.to) {
+				write_corpus_board(seed, &st);
+			} else {
+				printf("%lu %d %d %d %d\n", seed, st.three_bv,
+					st.n_openings, st.largest_opening,
+					st.n_isolated);
+			}
+		}
+		if (seed == g_search_last) break;
+		if (tmp_path
+		 && difftime(time(NULL), saved) >= CHECKPOINT_INTERVAL) {
+			save_checkpoint(progname, tmp_path, seed);
+			saved = time(NULL);
+		}
+	}
+	fflush(stdout);
+	if (g_corpus.to) end_corpus(progname);
+	if (g_checkpoint_path) remove(g_checkpoint_path);
+	free(tmp_path);
+}
+
 int main(int argc, char *argv[])
 {
 	char cmd[CMD_MAX + 1];
 	int len;
 	parse_options(argc, argv);
+	if (g_search) {
+		search_seeds(argv[0]);
+		return 0;
+	}
+	if (g_dump_path) {
+		read_corpus(argv[0], g_dump_path, 0);
+		return 0;
+	}
+	if (g_verify_path) {
+		return read_corpus(argv[0], g_verify_path, 1)
+			? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	if (g_replay_path) {
+		run_replay(argv[0]);
+		goto print_score;
+	}
+	/* Flags can be placed before the board is generated, so the counts
+	 * around the tiles must be right from the start. */
+	clear_board();
+	if (g_journal_path && !open_journal(argv[0])) goto print_score;
+	start_recording(argv[0]);
 	print_board();
 	puts("Type a command. For help, type '?' then ENTER.");
 	cmd[CMD_MAX] = '\0';
@@ -543,6 +5384,13 @@ int main(int argc, char *argv[])
 	}
 	print_quit_info();
 print_score:
+	end_journal();
+	if (g_record) fclose(g_record);
 	printf("Score: %ld\n", calc_score());
+	if (g_show_stats && g_board_initialized) {
+		struct board_stats st;
+		board_stats(&st, NULL);
+		print_stats(&st);
+	}
 	return 0;
 }